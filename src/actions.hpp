@@ -2,30 +2,36 @@
 #define GO_ACTIONS_H
 
 #include "base.hpp"
-#include <variant>
-#include <vector>
+#include <cstdint>
 
-//enum class GoBoardActionType {
-//    ADD_STONE,
-//    CAPTURE_STONES,
-//    PASS
-//};
+// A move packed into 16 bits:
+//   bit 15     colour, set for white
+//   bit 14     pass
+//   bits 0-8   point index (x * size + y), 0 for a pass
+typedef uint16_t GoPackedMove;
 
-struct PassAction {
-    GoTurn turn;
-};
+#define GO_MOVE_WHITE_BIT 0x8000
+#define GO_MOVE_PASS_BIT 0x4000
+#define GO_MOVE_INDEX_MASK 0x01FF
 
-struct AddStoneAction {
-    GoStone stone;
-};
+inline GoPackedMove packStone (int size, const GoStone& stone) {
+    return (stone.turn == GoTurn::WHITE ? GO_MOVE_WHITE_BIT : 0) | (stone.x * size + stone.y);
+}
 
-struct CaptureStonesAction {
-    GoStone capturing_stone;
-    std::vector<GoStone> removed_stones;
-};
+inline GoPackedMove packPass (GoTurn turn) {
+    return (turn == GoTurn::WHITE ? GO_MOVE_WHITE_BIT : 0) | GO_MOVE_PASS_BIT;
+}
 
-struct NoAction {};
+inline bool isPackedPass (GoPackedMove move) { return move & GO_MOVE_PASS_BIT; }
+inline int getPackedIndex (GoPackedMove move) { return move & GO_MOVE_INDEX_MASK; }
 
-using GoBoardAction = std::variant<NoAction, CaptureStonesAction, AddStoneAction, PassAction>;
+inline GoTurn getPackedTurn (GoPackedMove move) {
+    return move & GO_MOVE_WHITE_BIT ? GoTurn::WHITE : GoTurn::BLACK;
+}
+
+inline GoStone unpackStone (int size, GoPackedMove move) {
+    int index = getPackedIndex(move);
+    return {getPackedTurn(move), index / size, index % size};
+}
 
 #endif
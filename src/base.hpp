@@ -35,6 +35,10 @@ enum class GoTurn {
     WHITE
 };
 
+inline GoTurn getOppositeTurn (GoTurn turn) {
+    return turn == GoTurn::BLACK ? GoTurn::WHITE : GoTurn::BLACK;
+}
+
 struct GoStone {
     GoTurn turn;
     int x;
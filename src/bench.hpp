@@ -0,0 +1,650 @@
+#include "base.hpp"
+#include "compute.hpp"
+#include "katago.hpp"
+#include "katago_disk_cache.hpp"
+#include "katago_framer.hpp"
+#include "rules.hpp"
+#include "state.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Run with: ./go-game --bench
+
+#define BENCH_GAMES 200
+#define BENCH_MOVES_PER_GAME 300
+
+typedef std::vector<std::vector<GoBoardCellState>> GoBenchGrid;
+
+inline void printBenchResult (std::string bench, double value, std::string unit) {
+    std::cout << bench << ": " << value << " " << unit << "\n";
+}
+
+inline std::vector<GoStone> genBenchGame (int size, unsigned int seed) {
+    std::mt19937 generator(seed);
+    std::vector<GoStone> game;
+
+    GoBoardStateComputed board(size);
+    for (int i = 0; i < BENCH_MOVES_PER_GAME * 4 && game.size() < BENCH_MOVES_PER_GAME; i++) {
+        GoTurn turn = game.size() % 2 == 0 ? GoTurn::BLACK : GoTurn::WHITE;
+        GoStone stone = {turn, static_cast<int>(generator() % size), static_cast<int>(generator() % size)};
+
+        if (board.get(stone.x, stone.y) != GoBoardCellState::EMPTY
+                || !GoBoardRuleManager::isValidStone(board, stone))
+            continue;
+
+        std::vector<GoStone> removed_stones;
+        for (auto group : GoBoardRuleManager::getCapturedGroups(board, stone)) {
+            removed_stones.insert(removed_stones.end(), group.begin(), group.end());
+        }
+        board.placeStone(stone);
+        board.removeStones(removed_stones);
+        game.push_back(stone);
+    }
+
+    return game;
+}
+
+// The flood fill the rule manager used before the group table existed
+inline bool benchFloodFill (
+    const GoBenchGrid& grid, GoBoardCellState target,
+    int sx, int sy, std::vector<GoStone>* stones
+) {
+    int size = grid.size();
+    std::vector<std::vector<bool>> visited(size, std::vector<bool>(size, false));
+    std::vector<std::pair<int, int>> queue = {{sx, sy}};
+    visited[sx][sy] = true;
+
+    bool has_liberty = false;
+    for (int i = 0; i < queue.size(); i++) {
+        auto [x, y] = queue[i];
+        if (stones) stones->push_back({target == GoBoardCellState::BLACK ? GoTurn::BLACK : GoTurn::WHITE, x, y});
+
+        for (auto [dx, dy] : DIRECTIONS) {
+            int nx = x + dx, ny = y + dy;
+            if (nx < 0 || ny < 0 || nx >= size || ny >= size || visited[nx][ny]) continue;
+
+            if (grid[nx][ny] == GoBoardCellState::EMPTY) {
+                has_liberty = true;
+            } else if (grid[nx][ny] == target) {
+                visited[nx][ny] = true;
+                queue.push_back({nx, ny});
+            }
+        }
+    }
+
+    return has_liberty;
+}
+
+inline double benchFloodFillGame (int size, const std::vector<GoStone>& game) {
+    GoBenchGrid grid(size, std::vector<GoBoardCellState>(size, GoBoardCellState::EMPTY));
+
+    auto start = std::chrono::steady_clock::now();
+    for (const GoStone& stone : game) {
+        GoBoardCellState own = getCellStateFromTurn(stone.turn);
+        GoBoardCellState enemy = own == GoBoardCellState::BLACK ?
+            GoBoardCellState::WHITE :
+            GoBoardCellState::BLACK;
+
+        // Same work as isValidStone + getCapturedGroups on every move
+        grid[stone.x][stone.y] = own;
+        benchFloodFill(grid, own, stone.x, stone.y, nullptr);
+
+        std::vector<GoStone> removed_stones;
+        for (auto [dx, dy] : DIRECTIONS) {
+            int nx = stone.x + dx, ny = stone.y + dy;
+            if (nx < 0 || ny < 0 || nx >= size || ny >= size || grid[nx][ny] != enemy) continue;
+
+            std::vector<GoStone> group;
+            if (!benchFloodFill(grid, enemy, nx, ny, &group)) {
+                removed_stones.insert(removed_stones.end(), group.begin(), group.end());
+            }
+        }
+
+        for (const GoStone& removed : removed_stones) {
+            grid[removed.x][removed.y] = GoBoardCellState::EMPTY;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+inline double benchGroupTableGame (
+    int size,
+    const std::vector<GoStone>& game,
+    GoBoardKernels kernels
+) {
+    GoBoardStateComputed board(size, kernels);
+
+    auto start = std::chrono::steady_clock::now();
+    for (const GoStone& stone : game) {
+        GoBoardRuleManager::isValidStone(board, stone);
+
+        std::vector<GoStone> removed_stones;
+        for (auto group : GoBoardRuleManager::getCapturedGroups(board, stone)) {
+            removed_stones.insert(removed_stones.end(), group.begin(), group.end());
+        }
+        board.placeStone(stone);
+        board.removeStones(removed_stones);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+inline void benchRules () {
+    double flood_fill_ns = 0;
+    double group_table_ns = 0;
+    long moves = 0;
+
+    for (int i = 0; i < BENCH_GAMES; i++) {
+        std::vector<GoStone> game = genBenchGame(19, i);
+        flood_fill_ns += benchFloodFillGame(19, game);
+        group_table_ns += benchGroupTableGame(19, game, getBoardKernels(19));
+        moves += game.size();
+    }
+
+    printBenchResult("benchRules[19x19 flood fill]", flood_fill_ns / moves, "ns/move");
+    printBenchResult("benchRules[19x19 group table]", group_table_ns / moves, "ns/move");
+    std::cout << std::endl;
+}
+
+inline void benchKernels () {
+    for (int size : {9, 13, 19}) {
+        double generic_ns = 0;
+        double specialised_ns = 0;
+        long moves = 0;
+
+        for (int i = 0; i < BENCH_GAMES; i++) {
+            std::vector<GoStone> game = genBenchGame(size, i);
+            generic_ns += benchGroupTableGame(size, game, getGenericBoardKernels());
+            specialised_ns += benchGroupTableGame(size, game, getBoardKernels(size));
+            moves += game.size();
+        }
+
+        std::string board = std::to_string(size) + "x" + std::to_string(size);
+        printBenchResult("benchKernels[" + board + " generic]", generic_ns / moves, "ns/move");
+        printBenchResult("benchKernels[" + board + " specialised]", specialised_ns / moves, "ns/move");
+    }
+    std::cout << std::endl;
+}
+
+inline void benchLegalMoves () {
+    double per_point_ns = 0;
+    double mask_ns = 0;
+    long positions = 0;
+
+    for (int i = 0; i < BENCH_GAMES / 10; i++) {
+        GoBoardState state(GoBoardSize::_19x19);
+        for (const GoStone& stone : genBenchGame(19, i)) {
+            state.addStone(stone);
+            const GoBoardStateComputed& computed = state.getComputed();
+            GoTurn turn = state.getTurnToPlay();
+
+            // What hovering over every point used to cost
+            auto start = std::chrono::steady_clock::now();
+            int legal = 0;
+            for (int x = 0; x < 19; x++) {
+                for (int y = 0; y < 19; y++) {
+                    legal += computed.get(x, y) == GoBoardCellState::EMPTY
+                        && GoBoardRuleManager::isValidStone(computed, {turn, x, y});
+                }
+            }
+            auto end = std::chrono::steady_clock::now();
+            per_point_ns += std::chrono::duration<double, std::nano>(end - start).count();
+
+            start = std::chrono::steady_clock::now();
+            legal += state.getLegalMoves(turn).count();
+            end = std::chrono::steady_clock::now();
+            mask_ns += std::chrono::duration<double, std::nano>(end - start).count();
+
+            positions++;
+        }
+    }
+
+    printBenchResult("benchLegalMoves[19x19 isValidStone per point]", per_point_ns / positions, "ns/position");
+    printBenchResult("benchLegalMoves[19x19 mask]", mask_ns / positions, "ns/position");
+    std::cout << std::endl;
+}
+
+inline void benchUndoRedo () {
+    GoBoardState state(GoBoardSize::_19x19);
+    for (const GoStone& stone : genBenchGame(19, 0)) {
+        state.addStone(stone);
+    }
+
+    int moves = state.getMoveCount();
+
+    std::vector<GoGameLine> nodes;
+    for (GoGameLine node = state.getCurrentNode(); node; node = node->parent) {
+        nodes.push_back(node);
+    }
+
+    // Old behaviour: every step replays the game from an empty board
+    auto start = std::chrono::steady_clock::now();
+    for (const GoGameLine& node : nodes) {
+        computeActions(GoBoardSize::_19x19, state.getTree(), node.get());
+    }
+    auto end = std::chrono::steady_clock::now();
+    double replay_ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+    start = std::chrono::steady_clock::now();
+    while (state.undo().ok_value());
+    while (state.redo().ok_value());
+    end = std::chrono::steady_clock::now();
+    double delta_ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+    printBenchResult("benchUndoRedo[19x19 replay]", replay_ns / (moves + 1), "ns/step");
+    printBenchResult("benchUndoRedo[19x19 delta]", delta_ns / (moves * 2), "ns/step");
+    std::cout << std::endl;
+}
+
+inline void benchCheckpoints () {
+    GoBoardState state(GoBoardSize::_19x19);
+    for (const GoStone& stone : genBenchGame(19, 0)) {
+        state.addStone(stone);
+    }
+    const GoBoardStateComputed& computed = state.getComputed();
+
+    const int copies = 1000;
+    size_t checksum = 0;
+
+    // Old behaviour: checkpoints were whole states, group table included
+    std::vector<GoBoardStateComputed> states;
+    states.reserve(copies);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < copies; i++) {
+        states.push_back(computed);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double state_ns = std::chrono::duration<double, std::nano>(end - start).count();
+    checksum += states.back().getPosition().getHash();
+
+    std::vector<GoBoardCheckpoint> checkpoints;
+    checkpoints.reserve(copies);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < copies; i++) {
+        checkpoints.push_back(computed.getCheckpoint());
+    }
+    end = std::chrono::steady_clock::now();
+    double checkpoint_ns = std::chrono::duration<double, std::nano>(end - start).count();
+    checksum += checkpoints.back().position.getHash();
+
+    GoBoardCheckpoint checkpoint = computed.getCheckpoint();
+    GoBoardStateComputed restored(19);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < copies; i++) {
+        restored.restore(checkpoint);
+        checksum += restored.getGroups().getGroup(restored.getPosition().toPoint(i % 19, 0));
+    }
+    end = std::chrono::steady_clock::now();
+    double restore_ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+    if (checksum == 0) {
+        std::cout << "benchCheckpoints: empty board\n";
+    }
+
+    printBenchResult("benchCheckpoints[19x19 state size]", sizeof(GoBoardStateComputed), "bytes");
+    printBenchResult("benchCheckpoints[19x19 checkpoint size]", sizeof(GoBoardCheckpoint), "bytes");
+    printBenchResult("benchCheckpoints[19x19 state copy]", state_ns / copies, "ns/copy");
+    printBenchResult("benchCheckpoints[19x19 checkpoint copy]", checkpoint_ns / copies, "ns/copy");
+    printBenchResult("benchCheckpoints[19x19 checkpoint restore]", restore_ns / copies, "ns/restore");
+    std::cout << std::endl;
+}
+
+inline void benchGameTree () {
+    std::vector<GoBoardState> games;
+    long moves = 0;
+    long nodes = 0;
+    size_t captured = 0;
+    for (int i = 0; i < BENCH_GAMES; i++) {
+        games.emplace_back(GoBoardSize::_19x19);
+        GoBoardState& state = games.back();
+        std::vector<GoStone> game = genBenchGame(19, i);
+        for (const GoStone& stone : game) {
+            state.addStone(stone);
+        }
+
+        // Explore a second line from the middle of the game
+        state.seek(game.size() / 2);
+        for (const GoStone& stone : genBenchGame(19, BENCH_GAMES + i)) {
+            state.addStone(stone);
+        }
+
+        moves += state.getMoveCount();
+        nodes += state.getTree().getNodeCount();
+        captured += state.getTree().getCapturedSize();
+    }
+
+    // Node, its control block and the tree's captured point indexes,
+    // children lists not included
+    double bytes = nodes * (sizeof(GoGameNode) + 2 * sizeof(void*)) + captured * sizeof(uint16_t);
+
+    auto start = std::chrono::steady_clock::now();
+    long handed_off = 0;
+    for (const GoBoardState& game : games) {
+        GoGameLine line = game.getCurrentNode();
+        handed_off += line->move_number;
+    }
+    auto end = std::chrono::steady_clock::now();
+    double handoff_ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+    printBenchResult("benchGameTree[19x19 tree size]", bytes / nodes, "bytes/node");
+    printBenchResult("benchGameTree[19x19 nodes per line move]", double(nodes) / moves, "nodes/move");
+    printBenchResult("benchGameTree[19x19 engine handoff]", handoff_ns / games.size(), "ns/line");
+    std::cout << std::endl;
+}
+
+inline void benchDiskCache () {
+    std::string path = (std::filesystem::temp_directory_path() / "go-bench-analysis.cache").string();
+    std::remove(path.c_str());
+
+    KataGoQuery query = getEvaluationQuery("", GoBoardSize::_19x19);
+    query.max_visits = 20;
+    KataGoEvaluation evaluation = {
+        1.5,
+        std::vector<std::vector<double>>(19, std::vector<double>(19, 0.25)),
+        std::vector<KataGoCandidate>(GO_DISK_CACHE_CANDIDATES, {"Q16", 100, 0.5, 1.5})
+    };
+
+    int entries = 10000;
+    {
+        KataGoDiskCache cache(path, size_t(1) << 30);
+        for (int i = 0; i < entries; i++) {
+            cache.put(KataGoEvaluationKey::fromQuery(i, GoTurn::BLACK, query), evaluation);
+        }
+    }
+
+    // Opening a cache from an earlier session only reads the record headers
+    auto start = std::chrono::steady_clock::now();
+    KataGoDiskCache cache(path, size_t(1) << 30);
+    cache.load();
+    int count = cache.getEntryCount();
+    auto end = std::chrono::steady_clock::now();
+    double open_ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+    start = std::chrono::steady_clock::now();
+    int found = 0;
+    for (int i = 0; i < entries; i++) {
+        found += cache.get(KataGoEvaluationKey::fromQuery(i, GoTurn::BLACK, query)).has_value();
+    }
+    end = std::chrono::steady_clock::now();
+    double get_ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+    printBenchResult("benchDiskCache[19x19 record size]", double(cache.getFileSize()) / count, "bytes/entry");
+    printBenchResult("benchDiskCache[19x19 open and index]", open_ns / count, "ns/entry");
+    printBenchResult("benchDiskCache[19x19 lookup]", get_ns / found, "ns/lookup");
+    std::cout << std::endl;
+
+    std::remove(path.c_str());
+}
+
+// One line of KataGo output as a 19x19 analysis with ownership comes back,
+// about 10 KB of JSON
+inline std::string genBenchResponse (int id, std::mt19937& generator) {
+    std::uniform_real_distribution<double> value(-1, 1);
+    static const char* moves[] = {"Q16", "D4", "Q4", "D16", "R17", "C3", "P17", "E3"};
+
+    json move_infos = json::array();
+    for (int i = 0; i < 8; i++) {
+        move_infos.push_back({
+            {"move", moves[i]}, {"order", i}, {"visits", 100 - i * 10},
+            {"winrate", value(generator)}, {"scoreLead", value(generator) * 10},
+            {"pv", {moves[i], moves[(i + 1) % 8], moves[(i + 2) % 8]}}
+        });
+    }
+
+    std::vector<double> ownership(19 * 19);
+    for (double& point : ownership) point = value(generator);
+
+    json response = {
+        {"id", "q" + std::to_string(id)}, {"turnNumber", 0},
+        {"isDuringSearch", id % 4 != 3},
+        {"rootInfo", {{"currentPlayer", "B"}, {"scoreLead", 1.5}, {"winrate", 0.5}, {"visits", 100}}},
+        {"moveInfos", move_infos}, {"ownership", ownership}
+    };
+    return response.dump() + "\n";
+}
+
+// Framing the reader's output into lines, fed in reads of the size a pipe
+// hands out. Copying every line out and erasing it from the front of the
+// buffer is what the reader did before.
+inline void benchLineFramer () {
+    std::mt19937 generator(7);
+    std::string output;
+    int line_count = 2000;
+    for (int i = 0; i < line_count; i++) {
+        output += genBenchResponse(i, generator);
+    }
+
+    int rounds = 20;
+    double megabytes = double(output.size()) * rounds / (1 << 20);
+    printBenchResult("benchLineFramer[line size]", double(output.size()) / line_count, "bytes");
+
+    // A pipe hands out what is buffered, up to 64 KiB while KataGo is busy
+    for (size_t read_size : {4096, 65536}) {
+        auto start = std::chrono::steady_clock::now();
+        size_t copy_checksum = 0;
+        for (int round = 0; round < rounds; round++) {
+            std::string current;
+            for (size_t done = 0; done < output.size(); done += read_size) {
+                current.append(output, done, read_size);
+                size_t pos;
+                while ((pos = current.find('\n')) != std::string::npos) {
+                    std::string line = current.substr(0, pos);
+                    current.erase(0, pos + 1);
+                    copy_checksum += line.size();
+                }
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        double copy_seconds = std::chrono::duration<double>(end - start).count();
+
+        start = std::chrono::steady_clock::now();
+        size_t framer_checksum = 0;
+        for (int round = 0; round < rounds; round++) {
+            KataGoLineFramer framer;
+            for (size_t done = 0; done < output.size();) {
+                auto [data, size] = framer.prepare();
+                size_t count = std::min({size, read_size, output.size() - done});
+                std::memcpy(data, output.data() + done, count);
+                framer.commit(count);
+                done += count;
+                framer.forEachLine([&](std::string_view line) { framer_checksum += line.size(); });
+            }
+        }
+        end = std::chrono::steady_clock::now();
+        double framer_seconds = std::chrono::duration<double>(end - start).count();
+
+        if (copy_checksum != framer_checksum) {
+            std::cout << "benchLineFramer: framed lines differ" << std::endl;
+        }
+
+        std::string reads = std::to_string(read_size / 1024) + " KiB reads";
+        printBenchResult("benchLineFramer[copy and erase, " + reads + "]", megabytes / copy_seconds, "MB/s");
+        printBenchResult("benchLineFramer[framer, " + reads + "]", megabytes / framer_seconds, "MB/s");
+    }
+    std::cout << std::endl;
+}
+
+// Turning a line of 19x19 analysis into the fields we use. Parsing into a
+// json DOM and reading the fields out of it is what the reader did before.
+inline void benchResponseDecoding () {
+    std::mt19937 generator(11);
+    std::vector<std::string> lines;
+    int line_count = 2000;
+    for (int i = 0; i < line_count; i++) {
+        lines.push_back(genBenchResponse(i, generator));
+        lines.back().pop_back();
+    }
+
+    int rounds = 5;
+    auto start = std::chrono::steady_clock::now();
+    double dom_checksum = 0;
+    for (int round = 0; round < rounds; round++) {
+        for (const std::string& line : lines) {
+            json msg = json::parse(line);
+            std::vector<double> ownership(msg["ownership"].size());
+            for (int i = 0; i < ownership.size(); i++) {
+                ownership[i] = msg["ownership"][i];
+            }
+            for (const json& info : msg["moveInfos"]) {
+                dom_checksum += info.value("visits", 0);
+            }
+            dom_checksum += ownership[0] + msg["rootInfo"].value("scoreLead", 0.0);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    double dom_ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+    start = std::chrono::steady_clock::now();
+    double decoder_checksum = 0;
+    KataGoResponse response;
+    for (int round = 0; round < rounds; round++) {
+        for (const std::string& line : lines) {
+            KataGoResponseDecoder::decode(line, response);
+            for (const KataGoCandidate& info : response.move_infos) {
+                decoder_checksum += info.visits;
+            }
+            decoder_checksum += response.ownership[0] + response.score_lead;
+        }
+    }
+    end = std::chrono::steady_clock::now();
+    double decoder_ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+    if (dom_checksum != decoder_checksum) {
+        std::cout << "benchResponseDecoding: decoded fields differ" << std::endl;
+    }
+
+    printBenchResult("benchResponseDecoding[19x19 json DOM]", dom_ns / (rounds * line_count) / 1000, "us/response");
+    printBenchResult("benchResponseDecoding[19x19 decoder]", decoder_ns / (rounds * line_count) / 1000, "us/response");
+    std::cout << std::endl;
+}
+
+// Building the query for a position after one more move, at several game
+// lengths. Writing out every move of the line into nested vectors and
+// dumping them with the rest of the json is what each query did before.
+inline void benchQuerySerialization () {
+    GoBoardState state(GoBoardSize::_19x19);
+    for (const GoStone& stone : genBenchGame(19, 3)) {
+        state.addStone(stone);
+    }
+
+    std::vector<GoGameLine> nodes(state.getCurrentNode()->move_number + 1);
+    for (GoGameLine node = state.getCurrentNode(); node; node = node->parent) {
+        nodes[node->move_number] = node;
+    }
+
+    int rounds = 2000;
+    for (int length : {50, 150, 300}) {
+        if (length >= static_cast<int>(nodes.size())) break;
+
+        // Old behaviour: a json object per query, moves included
+        auto start = std::chrono::steady_clock::now();
+        size_t json_size = 0;
+        for (int round = 0; round < rounds; round++) {
+            std::vector<std::vector<std::string>> moves;
+            for (GoPackedMove move : getLineMoves(nodes[length].get())) {
+                moves.push_back(stoneToKatagoMove(GoBoardSize::_19x19, unpackStone(19, move)));
+            }
+            json full_query = {
+                {"id", "q1"}, {"rules", "japanese"}, {"komi", 6.5},
+                {"boardXSize", 19}, {"boardYSize", 19},
+                {"maxVisits", 20}, {"rootPolicyTemperature", 0.3}, {"rootFpuReductionMax", 0.5},
+                {"includeOwnership", true}
+            };
+            full_query["moves"] = moves;
+            json_size += (full_query.dump() + "\n").size();
+        }
+        auto end = std::chrono::steady_clock::now();
+        double json_ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+        KataGoMoveList moves;
+        std::string out;
+        double list_ns = 0;
+        size_t list_size = 0;
+        for (int round = 0; round < rounds; round++) {
+            moves.update(GoBoardSize::_19x19, nodes[length - 1]);
+
+            start = std::chrono::steady_clock::now();
+            KataGoQuery query = getEvaluationQuery("q1", GoBoardSize::_19x19);
+            writeKataGoQuery(out, query, *moves.update(GoBoardSize::_19x19, nodes[length]));
+            end = std::chrono::steady_clock::now();
+            list_ns += std::chrono::duration<double, std::nano>(end - start).count();
+            list_size += out.size();
+        }
+
+        if (json_size != list_size) {
+            std::cout << "benchQuerySerialization: written queries differ" << std::endl;
+        }
+
+        std::string moves_label = std::to_string(length) + " moves";
+        printBenchResult("benchQuerySerialization[json, " + moves_label + "]", json_ns / rounds, "ns/query");
+        printBenchResult("benchQuerySerialization[move list, " + moves_label + "]", list_ns / rounds, "ns/query");
+    }
+    std::cout << std::endl;
+}
+
+#ifndef WINDOWS
+// CPU used by an engine's reader thread while KataGo has nothing to say. A
+// shell script that swallows its input stands in for KataGo.
+inline void benchEngineIdle () {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "go-bench-engine";
+    std::filesystem::create_directories(dir);
+    std::string engine_path = (dir / "katago").string();
+    std::string config_path = (dir / "analysis.cfg").string();
+    std::string model_path = (dir / "model.bin.gz").string();
+
+    std::ofstream(engine_path) << "#!/bin/sh\nexec cat > /dev/null\n";
+    std::ofstream(config_path).close();
+    std::ofstream(model_path).close();
+    std::filesystem::permissions(engine_path, std::filesystem::perms::owner_all);
+
+    auto getCpuSeconds = [] {
+        timespec time;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+        return time.tv_sec + time.tv_nsec / 1e9;
+    };
+
+    int seconds = 2;
+    double cpu_seconds;
+    {
+        KataGoEngine engine(engine_path, config_path, model_path);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        double cpu_start = getCpuSeconds();
+        std::this_thread::sleep_for(std::chrono::seconds(seconds));
+        cpu_seconds = getCpuSeconds() - cpu_start;
+    }
+
+    printBenchResult("benchEngineIdle[reader CPU while idle]", cpu_seconds * 1000 / seconds, "ms/s");
+    std::cout << std::endl;
+
+    std::filesystem::remove_all(dir);
+}
+#endif
+
+inline void runBenchmarks () {
+    benchRules();
+    benchKernels();
+    benchLegalMoves();
+    benchUndoRedo();
+    benchCheckpoints();
+    benchGameTree();
+    benchDiskCache();
+    benchLineFramer();
+    benchResponseDecoding();
+    benchQuerySerialization();
+#ifndef WINDOWS
+    benchEngineIdle();
+#endif
+}
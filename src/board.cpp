@@ -1,6 +1,5 @@
 #include "board.hpp"
 #include "base.hpp"
-#include "config.hpp"
 #include "draw.hpp"
 #include "error.hpp"
 #include "katago.hpp"
@@ -18,20 +17,21 @@
 #include <optional>
 #include <string>
 
-GoBoard::GoBoard (SDL_Renderer* renderer, int w, int h, GoBoardSize dim)
+// Shared by every board, a board only acts on the results it queued itself
+static Uint32 getEngineEvent () {
+    static Uint32 type = SDL_RegisterEvents(1);
+    return type;
+}
+
+GoBoard::GoBoard (SDL_Renderer* renderer, int w, int h, GoBoardSize dim, std::shared_ptr<KataGoService> katago_service)
 {
+    this->engine_event = getEngineEvent();
     this->dim = dim;
     this->window_w = w;
     this->window_h = h;
     this->renderer = renderer;
 
-    this->katago = std::make_unique<KataGo>(
-        !GoGameConfig::isEngineEnabled(),
-        GoGameConfig::getKatagoPath(),
-        GoGameConfig::getKatagoConfigPath(),
-        GoGameConfig::getModelPath(),
-        dim
-    );
+    this->katago = std::make_shared<KataGo>(katago_service, dim);
 
     this->state = std::make_shared<GoBoardState>(dim);
     this->turn = GoTurn::BLACK;
@@ -42,6 +42,60 @@ GoBoard::GoBoard (SDL_Renderer* renderer, int w, int h, GoBoardSize dim)
     this->katago_evaluation = {0, std::vector<std::vector<double>>(board_dim, std::vector<double>(board_dim, 0))};
 }
 
+GoBoard::~GoBoard () {
+    // Cancelled queries come back empty, so the workers finish promptly
+    is_closing = true;
+    katago->stop();
+
+    std::unique_lock<std::mutex> lock(worker_mutex);
+    worker_done.wait(lock, [&] { return worker_count == 0; });
+}
+
+void GoBoard::startWorker (std::function<void()> work) {
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        worker_count++;
+    }
+
+    std::thread([this, work = std::move(work)]() {
+        work();
+
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        worker_count--;
+        worker_done.notify_all();
+    }).detach();
+}
+
+void GoBoard::pushEngineEvent () {
+    SDL_Event event;
+    SDL_zero(event);
+    event.type = engine_event;
+    SDL_PushEvent(&event);
+}
+
+void GoBoard::handleEngineResults () {
+    std::vector<std::pair<GoGameLine, std::variant<GoStone, GoTurn>>> moves;
+    std::optional<std::pair<GoGameLine, KataGoEvaluation>> evaluation;
+    {
+        std::lock_guard<std::mutex> lock(engine_result_mutex);
+        moves.swap(engine_moves);
+        evaluation.swap(engine_evaluation);
+    }
+
+    // Likely replies are analysed while the user thinks, from the board on
+    // screen rather than a replay of the line
+    if (evaluation.has_value() && this->state->getCurrentNode() == evaluation->first) {
+        katago->speculate(evaluation->first, this->state->getComputed(), evaluation->second);
+    }
+
+    for (const auto& [line, go_move] : moves) {
+        // The move is for the position it was asked for
+        if (this->state->getCurrentNode() == line) {
+            this->handleGoMove(go_move);
+        }
+    }
+}
+
 void GoBoard::setupTextEngine(TTF_TextEngine* text_engine, TTF_Font* font) {
     this->text_engine = text_engine;
     this->font = font;
@@ -51,8 +105,90 @@ void GoBoard::updateBoardInfo(int w, int h) {
     board = GetGoBoardInfo(w, h, dim);
 }
 
+void GoBoard::setEvaluation(uint64_t id, const KataGoEvaluation& evaluation) {
+    std::lock_guard<std::mutex> lock(evaluation_mutex);
+    if (id == evaluation_id.load()) {
+        katago_evaluation = evaluation;
+    }
+}
+
+void GoBoard::evaluatePosition() {
+    uint64_t id = ++evaluation_id;
+    katago->cancelEvaluation();
+    katago->cancelSpeculation();
+
+    // Scrubbing through an analysed game never reaches the engine
+    auto cached_evaluation_opt = katago->getCachedEvaluation(state->getCurrentNode().get());
+    if (cached_evaluation_opt.has_value()) {
+        setEvaluation(id, cached_evaluation_opt.value());
+        has_evaluation = true;
+        return;
+    }
+
+    if (!katago->isInitialized() || katago->isDisabled()) {
+        has_evaluation = false;
+        return;
+    }
+
+    startWorker([&, id, line = state->getCurrentNode()]() {
+        // Snapshots refine the score and ownership while the search runs
+        auto katago_evaluation_opt = katago->getEvaluation(line, [&, id](const KataGoEvaluation& partial) {
+            setEvaluation(id, partial);
+        });
+        if (katago_evaluation_opt.has_value()) {
+            setEvaluation(id, katago_evaluation_opt.value());
+
+            // Only a position the engine had to analyse is speculated on,
+            // scrubbing through cached ones leaves the engine alone
+            if (id == evaluation_id.load() && !is_closing) {
+                {
+                    std::lock_guard<std::mutex> lock(engine_result_mutex);
+                    engine_evaluation = {line, katago_evaluation_opt.value()};
+                }
+                pushEngineEvent();
+            }
+        }
+    });
+}
+
+void GoBoard::handleSeekInput(SDL_KeyboardEvent key_event) {
+    SDL_Scancode scancode = key_event.scancode;
+
+    if (scancode == SDL_SCANCODE_ESCAPE) {
+        this->seek_input = std::nullopt;
+    } else if (scancode == SDL_SCANCODE_BACKSPACE) {
+        if (!this->seek_input->empty()) this->seek_input->pop_back();
+    } else if (scancode == SDL_SCANCODE_RETURN || scancode == SDL_SCANCODE_KP_ENTER) {
+        if (!this->seek_input->empty()) {
+            katago->cancelMoveGeneration();
+            Result<bool, GoErrorEnum> res = this->state->seek(std::stoi(this->seek_input.value()));
+            if (res.is_err()) {
+                SDL_Log("Seek error");
+            }
+
+            if (res.is_ok() && res.ok_value()) {
+                if (this->auto_switch_flag) {
+                    this->turn = this->state->getTurnToPlay();
+                }
+                evaluatePosition();
+            }
+        }
+        this->seek_input = std::nullopt;
+    } else if (this->seek_input->size() < 4) {
+        if (scancode >= SDL_SCANCODE_1 && scancode <= SDL_SCANCODE_9) {
+            this->seek_input->push_back('1' + (scancode - SDL_SCANCODE_1));
+        } else if (scancode == SDL_SCANCODE_0) {
+            this->seek_input->push_back('0');
+        } else if (scancode >= SDL_SCANCODE_KP_1 && scancode <= SDL_SCANCODE_KP_9) {
+            this->seek_input->push_back('1' + (scancode - SDL_SCANCODE_KP_1));
+        } else if (scancode == SDL_SCANCODE_KP_0) {
+            this->seek_input->push_back('0');
+        }
+    }
+}
+
 void GoBoard::handleGoMove(std::variant<GoStone, GoTurn> go_move) {
-    if (katago->isBusy()) return;
+    katago->cancelMoveGeneration();
     std::visit([&](auto &&go_move) {
         using T = std::decay_t<decltype(go_move)>;
         if constexpr (std::is_same_v<T, GoStone>) {
@@ -68,12 +204,7 @@ void GoBoard::handleGoMove(std::variant<GoStone, GoTurn> go_move) {
                         GoTurn::BLACK :
                         GoTurn::WHITE;
                 }
-                std::thread([&]() {
-                    auto katago_evaluation_opt = katago->getEvaluation(state->getActionsWithUndo());
-                    if (katago_evaluation_opt.has_value()) {
-                        katago_evaluation = katago_evaluation_opt.value();
-                    }
-                }).detach();
+                evaluatePosition();
             }
         }
         else if constexpr (std::is_same_v<T, GoTurn>) {
@@ -89,12 +220,7 @@ void GoBoard::handleGoMove(std::variant<GoStone, GoTurn> go_move) {
                         GoTurn::BLACK :
                         GoTurn::WHITE;
                 }
-                std::thread([&]() {
-                    auto katago_evaluation_opt = katago->getEvaluation(state->getActionsWithUndo());
-                    if (katago_evaluation_opt.has_value()) {
-                        katago_evaluation = katago_evaluation_opt.value();
-                    }
-                }).detach();
+                evaluatePosition();
             }
         }
     }, go_move);
@@ -108,6 +234,11 @@ void GoBoard::handleEvent(SDL_Event* event, const std::vector<GoError>& errors)
         return;
     }
 
+    if (event->type == engine_event) {
+        this->handleEngineResults();
+        return;
+    }
+
     switch (event->type) {
         case SDL_EVENT_KEY_DOWN: {
             SDL_KeyboardEvent key_event = event->key;
@@ -131,7 +262,14 @@ void GoBoard::handleEvent(SDL_Event* event, const std::vector<GoError>& errors)
                 break;
             }
 
-            if (key_event.scancode == SDL_SCANCODE_M) {
+            if (this->seek_input.has_value()) {
+                this->handleSeekInput(key_event);
+                break;
+            }
+
+            if (key_event.scancode == SDL_SCANCODE_G) {
+                this->seek_input = std::make_optional<std::string>();
+            } else if (key_event.scancode == SDL_SCANCODE_M) {
                 GoSound::toggleMusic();
             } else if (key_event.scancode == SDL_SCANCODE_T) {
                 GoThemeHandler::nextTheme();
@@ -146,61 +284,70 @@ void GoBoard::handleEvent(SDL_Event* event, const std::vector<GoError>& errors)
             } else if (key_event.scancode == SDL_SCANCODE_X) {
                 this->auto_switch_flag = !this->auto_switch_flag;
             } else if (key_event.scancode == SDL_SCANCODE_U) {
-                if (!katago->isBusy()) {
-                    Result<bool, GoErrorEnum> res = this->state->undo();
-                    if (res.is_err()) {
-                        SDL_Log("Undo error");
-                    }
+                // Navigating supersedes whatever the engine was thinking about
+                katago->cancelMoveGeneration();
+                Result<bool, GoErrorEnum> res = this->state->undo();
+                if (res.is_err()) {
+                    SDL_Log("Undo error");
+                }
 
-                    if (this->auto_switch_flag && res.is_ok() && res.ok_value()) {
+                if (res.is_ok() && res.ok_value()) {
+                    if (this->auto_switch_flag) {
                         this->turn = this->turn == GoTurn::WHITE ?
                             GoTurn::BLACK :
                             GoTurn::WHITE;
-                        std::thread([&]() {
-                            auto katago_evaluation_opt = katago->getEvaluation(state->getActionsWithUndo());
-                            if (katago_evaluation_opt.has_value()) {
-                                katago_evaluation = katago_evaluation_opt.value();
-                            }
-                        }).detach();
                     }
-                } else {
-                    GoErrorHandler::throwError(GoErrorEnum::ENGINE_BUSY);
+                    evaluatePosition();
                 }
             } else if (key_event.scancode == SDL_SCANCODE_R) {
-                if (!katago->isBusy()) {
-                    Result<bool, GoErrorEnum> res = this->state->redo();
-                    if (res.is_err()) {
-                        SDL_Log("Redo error");
-                    }
+                // Navigating supersedes whatever the engine was thinking about
+                katago->cancelMoveGeneration();
+                Result<bool, GoErrorEnum> res = this->state->redo();
+                if (res.is_err()) {
+                    SDL_Log("Redo error");
+                }
 
-                    if (this->auto_switch_flag && res.is_ok() && res.ok_value()) {
+                if (res.is_ok() && res.ok_value()) {
+                    if (this->auto_switch_flag) {
                         this->turn = this->turn == GoTurn::WHITE ?
                             GoTurn::BLACK :
                             GoTurn::WHITE;
-                        std::thread([&]() {
-                            auto katago_evaluation_opt = katago->getEvaluation(state->getActionsWithUndo());
-                            if (katago_evaluation_opt.has_value()) {
-                                katago_evaluation = katago_evaluation_opt.value();
-                            }
-                        }).detach();
                     }
-                } else {
+                    evaluatePosition();
+                }
+            } else if (key_event.scancode == SDL_SCANCODE_A) {
+                if (!this->katago->isInitialized() || this->katago->isDisabled()) {
+                    GoErrorHandler::throwError(GoErrorEnum::ENGINE_NOT_FOUND);
+                } else if (!this->katago->reviewGame(this->state->getLastNode())) {
                     GoErrorHandler::throwError(GoErrorEnum::ENGINE_BUSY);
                 }
+            } else if (key_event.scancode == SDL_SCANCODE_N) {
+                this->state->switchVariation(1);
             } else if (key_event.scancode == SDL_SCANCODE_P) {
                 this->handleGoMove(this->turn);
             } else if (key_event.scancode == SDL_SCANCODE_SPACE) {
                 if (this->katago->isBusy()) {
                     GoErrorHandler::throwError(GoErrorEnum::ENGINE_BUSY);
                 } else if (!this->state->getComputed().isGameEnded()) {
-                    std::thread([&]() {
-                        auto go_move_opt = this->katago->nextNMoves(this->state->getActionsWithUndo(), 1);
+                    std::vector<GoStone> avoid_moves =
+                        this->state->getIllegalMoves(this->state->getTurnToPlay());
+
+                    startWorker([&, avoid_moves, line = this->state->getCurrentNode()]() {
+                        auto go_move_opt = this->katago->nextNMoves(line, 1, avoid_moves);
                         if (go_move_opt.has_value()) {
-                            this->handleGoMove(go_move_opt.value());
-                        } else {
+                            if (is_closing)
+                                return;
+
+                            {
+                                std::lock_guard<std::mutex> lock(engine_result_mutex);
+                                engine_moves.push_back({line, go_move_opt.value()});
+                            }
+                            pushEngineEvent();
+                        } else if (!this->katago->isInitialized() || this->katago->isDisabled()) {
+                            // Otherwise the query was cancelled by a newer position
                             GoErrorHandler::throwError(GoErrorEnum::ENGINE_NOT_FOUND);
                         }
-                    }).detach();
+                    });
                 }
             } else if (key_event.scancode == SDL_SCANCODE_5) {
                 this->katago->updateDiffLevel(5);
@@ -221,11 +368,6 @@ void GoBoard::handleEvent(SDL_Event* event, const std::vector<GoError>& errors)
                 break;
             }
 
-            if (this->katago->isBusy()) {
-                GoErrorHandler::throwError(GoErrorEnum::ENGINE_BUSY);
-                break;
-            }
-
             SDL_MouseButtonEvent mouse_event = event->button;
             if (mouse_event.button == SDL_BUTTON_LEFT) {
                 std::optional<std::pair<int, int>> point_opt =
@@ -252,7 +394,7 @@ void GoBoard::render () {
     float mouse_x, mouse_y;
     Uint32 button_state = SDL_GetMouseState(&mouse_x, &mouse_y);
 
-    GoBoardStateComputed computed_state = this->state->getComputed();
+    const GoBoardStateComputed& computed_state = this->state->getComputed();
     if (!computed_state.isGameEnded()) {
         std::optional<std::pair<int, int>> point_opt =
             getBoardCellFromPoint(this->board, mouse_x, mouse_y);
@@ -261,10 +403,7 @@ void GoBoard::render () {
             int y = point_opt->second;
 
             GoStone stone = {turn, x, y};
-            GoBoardCellState cell_state = computed_state.get(x, y);
-            if (cell_state == GoBoardCellState::EMPTY
-                    && GoBoardRuleManager::isValidStone(computed_state, stone))
-            {
+            if (this->state->isLegalMove(stone)) {
                 GoDrawHelper::DrawStone(renderer, board, stone, 128);
             }
         }
@@ -290,6 +429,7 @@ void GoBoard::render () {
     }
 
     if (this->view_ownership) {
+        std::lock_guard<std::mutex> lock(evaluation_mutex);
         for (int x = 0; x < board_dim; x++) {
             for (int y = 0; y < board_dim; y++) {
                 GoDrawHelper::DrawOwnershipCell(
@@ -329,6 +469,13 @@ void GoBoard::renderUI () {
         bottom_right = {board.inner_x + board.inner_size, board.y + board.size - 10};
     }
 
+    // The current position is usually among the reviewed ones
+    KataGoReviewProgress review_progress = katago->getReviewProgress();
+    if (this->is_reviewing && !review_progress.isRunning()) {
+        evaluatePosition();
+    }
+    this->is_reviewing = review_progress.isRunning();
+
     if (this->show_text) {
         std::string auto_switch = "Auto Switch: ";
         auto_switch += auto_switch_flag ? "True" : "False";
@@ -344,6 +491,13 @@ void GoBoard::renderUI () {
                 text_engine, font, theme.error_text_color, top_center,
                 "[Engine Busy]", 12, GoTextAlign::MIDDLE_ALIGN
             );
+        } else if (review_progress.isRunning()) {
+            GoDrawHelper::DrawText(
+                text_engine, font, theme.text_color, top_center,
+                "[Reviewing " + std::to_string(review_progress.analysed)
+                    + " / " + std::to_string(review_progress.total) + "]",
+                12, GoTextAlign::MIDDLE_ALIGN
+            );
         } else if (katago->isInitialized()){
             std::string diff_levels = " 5  4  3  2  1 ";
             int diff_lvl = this->katago->getDiffLevel();
@@ -362,7 +516,20 @@ void GoBoard::renderUI () {
         std::string captures = getCapturesString(state->getCaptures(GoTurn::BLACK), state->getCaptures(GoTurn::WHITE));
         GoDrawHelper::DrawText(text_engine, font, theme.text_color, bottom_left, captures, 12);
 
-        if (!this->state->getComputed().isGameEnded()) {
+        if (this->seek_input.has_value()) {
+            GoDrawHelper::DrawText(
+                text_engine, font, theme.text_color, bottom_center,
+                "Go to move: " + this->seek_input.value() + "_ / " + std::to_string(this->state->getMoveCount()),
+                12, GoTextAlign::MIDDLE_ALIGN
+            );
+        } else if (this->state->getVariationCount() > 1) {
+            GoDrawHelper::DrawText(
+                text_engine, font, theme.text_color, bottom_center,
+                "Variation " + std::to_string(this->state->getVariationIndex() + 1)
+                    + " / " + std::to_string(this->state->getVariationCount()),
+                12, GoTextAlign::MIDDLE_ALIGN
+            );
+        } else if (!this->state->getComputed().isGameEnded()) {
             std::optional<GoTurn> in_pass = this->state->getComputed().inPass();
             if (in_pass.has_value()) {
                 GoDrawHelper::DrawText(
@@ -373,15 +540,21 @@ void GoBoard::renderUI () {
             }
         }
 
-        if (!katago->isDisabled() && katago->isInitialized()) {
+        if ((!katago->isDisabled() && katago->isInitialized()) || has_evaluation) {
+            double score_lead;
+            {
+                std::lock_guard<std::mutex> lock(evaluation_mutex);
+                score_lead = katago_evaluation.score;
+            }
+
             std::string score = "B+0";
-            if (katago_evaluation.score > 0) {
+            if (score_lead > 0) {
                 std::ostringstream oss;
-                oss << std::fixed << std::setprecision(2) << katago_evaluation.score;
+                oss << std::fixed << std::setprecision(2) << score_lead;
                 score = "B+" + oss.str();
-            } else if (katago_evaluation.score < 0) {
+            } else if (score_lead < 0) {
                 std::ostringstream oss;
-                oss << std::fixed << std::setprecision(2) << (katago_evaluation.score * -1);
+                oss << std::fixed << std::setprecision(2) << (score_lead * -1);
                 score = "W+" + oss.str();
             }
             GoDrawHelper::DrawText(
@@ -394,6 +567,15 @@ void GoBoard::renderUI () {
                 "[Needs KataGo]", 12, GoTextAlign::RIGHT_ALIGN
             );
         }
+
+        // Filled in as the review of the game streams back, kept afterwards
+        std::vector<std::optional<double>> review_timeline = katago->getReviewTimeline();
+        if (!review_timeline.empty()) {
+            SDL_FRect timeline_area = {board.x, bottom_left.second + 18.f, board.size, 12};
+            GoDrawHelper::DrawScoreTimeline(
+                renderer, timeline_area, review_timeline, this->state->getMoveNumber()
+            );
+        }
     }
 
     if (this->state->getComputed().isGameEnded()) {
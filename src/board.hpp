@@ -9,7 +9,17 @@
 #include <SDL3/SDL_render.h>
 #include <SDL3_ttf/SDL_textengine.h>
 #include <SDL3_ttf/SDL_ttf.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
 
 class GoBoard {
 private:
@@ -24,21 +34,62 @@ private:
     bool auto_switch_flag = true;
     GoTurn turn = GoTurn::BLACK;
 
-    std::unique_ptr<KataGo> katago;
+    std::shared_ptr<KataGo> katago;
     std::shared_ptr<GoBoardState> state;
 
+    // Written from engine threads while the search streams snapshots
+    std::mutex evaluation_mutex;
     KataGoEvaluation katago_evaluation;
+
+    // Evaluations may now finish out of order, only the latest is shown
+    std::atomic<uint64_t> evaluation_id = {0};
+
+    // Without an engine, whether the analysis cache knew the position
+    std::atomic<bool> has_evaluation = {false};
+
+    // Set while a whole game review started with A is running
+    bool is_reviewing = false;
     bool view_ownership = false;
 
+    // Digits typed after pressing G, committed with Enter
+    std::optional<std::string> seek_input = std::nullopt;
+
     GoBoardInfo board;
 
+    // Engine threads still running, the board waits for them before it goes
+    std::mutex worker_mutex;
+    std::condition_variable worker_done;
+    int worker_count = 0;
+    std::atomic<bool> is_closing = {false};
+
+    void startWorker (std::function<void()> work);
+
+    // Results of engine threads, with the position they were asked for.
+    // Only the main thread acts on them, when handleEvent gets the event
+    // pushed along with them, so the state is never used from two threads.
+    std::mutex engine_result_mutex;
+    std::vector<std::pair<GoGameLine, std::variant<GoStone, GoTurn>>> engine_moves;
+
+    // The last evaluation the engine finished for the position on screen,
+    // its top candidates are speculated on
+    std::optional<std::pair<GoGameLine, KataGoEvaluation>> engine_evaluation;
+    Uint32 engine_event;
+
+    void pushEngineEvent ();
+    void handleEngineResults ();
+
 public:
-    GoBoard (SDL_Renderer* renderer, int w, int h, GoBoardSize dim);
+    // The service is shared with the boards that come after this one
+    GoBoard (SDL_Renderer* renderer, int w, int h, GoBoardSize dim, std::shared_ptr<KataGoService> katago_service);
+    ~GoBoard ();
 
     void setupTextEngine(TTF_TextEngine* text_engine, TTF_Font* font);
     void updateBoardInfo (int w, int h);
 
     void handleGoMove (std::variant<GoStone, GoTurn> go_move);
+    void handleSeekInput (SDL_KeyboardEvent key_event);
+    void evaluatePosition ();
+    void setEvaluation (uint64_t id, const KataGoEvaluation& evaluation);
 
     void render();
     void handleEvent(SDL_Event* event, const std::vector<GoError>& errors);
@@ -4,3 +4,6 @@ bool GoGameConfig::engine_enabled               = true;
 std::string GoGameConfig::katago_path           = "./katago";
 std::string GoGameConfig::katago_config_path    = "./analysis_example.cfg";
 std::string GoGameConfig::model_path            = "./g170e-b20c256x2-s5303129600-d1228401921.bin.gz";
+std::string GoGameConfig::analysis_cache_path   = "./analysis.cache";
+int GoGameConfig::analysis_cache_max_mb         = 64;
+int GoGameConfig::katago_processes              = 1;
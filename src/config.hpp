@@ -14,6 +14,9 @@ class GoGameConfig {
     static std::string katago_path;
     static std::string katago_config_path;
     static std::string model_path;
+    static std::string analysis_cache_path;
+    static int analysis_cache_max_mb;
+    static int katago_processes;
 
 public:
     static void init (std::string config_path) {
@@ -29,6 +32,9 @@ public:
 #endif
             GoGameConfig::katago_config_path    = "./assets/KataGo/config/analysis_example.cfg";
             GoGameConfig::model_path            = "./assets/KataGo/models/kata1-b18c384nbt-s9996604416-d4316597426.bin.gz";
+            GoGameConfig::analysis_cache_path   = "./analysis.cache";
+            GoGameConfig::analysis_cache_max_mb = 64;
+            GoGameConfig::katago_processes      = 1;
 
             return;
         }
@@ -46,6 +52,9 @@ public:
 #endif
         GoGameConfig::katago_config_path    = getJSONOrDefault(parsed_json, "config_path", "./assets/KataGo/config/analysis_example.cfg");
         GoGameConfig::model_path            = getJSONOrDefault(parsed_json, "model_path", "./assets/KataGo/models/kata1-b18c384nbt-s9996604416-d4316597426.bin.gz");
+        GoGameConfig::analysis_cache_path   = getJSONOrDefault(parsed_json, "analysis_cache_path", "./analysis.cache");
+        GoGameConfig::analysis_cache_max_mb = getJSONOrDefault(parsed_json, "analysis_cache_max_mb", 64);
+        GoGameConfig::katago_processes      = getJSONOrDefault(parsed_json, "katago_processes", 1);
 
         input_file.close();
     }
@@ -54,6 +63,9 @@ public:
     static std::string getKatagoPath () { return katago_path; }
     static std::string getKatagoConfigPath () { return katago_config_path; }
     static std::string getModelPath () { return model_path; }
+    static std::string getAnalysisCachePath () { return analysis_cache_path; }
+    static int getAnalysisCacheMaxMB () { return analysis_cache_max_mb; }
+    static int getKatagoProcesses () { return katago_processes; }
 };
 
 #endif
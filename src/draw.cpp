@@ -3,6 +3,7 @@
 #include "base.hpp"
 #include "theme.hpp"
 #include <SDL3/SDL_pixels.h>
+#include <algorithm>
 
 void GoDrawHelper::DrawError(SDL_Renderer *renderer, TTF_TextEngine* text_engine, TTF_Font* font, GoError error, std::pair<int, int> window_size) {
     // Create wrapped surface
@@ -196,6 +197,48 @@ void GoDrawHelper::DrawBoard(SDL_Renderer *renderer, GoBoardInfo board) {
     }
 }
 
+void GoDrawHelper::DrawScoreTimeline (
+    SDL_Renderer* renderer,
+    SDL_FRect area,
+    const std::vector<std::optional<double>>& timeline,
+    int current_move
+) {
+    if (timeline.empty())
+        return;
+
+    GoTheme theme = GoThemeHandler::getTheme();
+    float bar_w = area.w / timeline.size();
+    float middle_y = area.y + area.h / 2;
+
+    for (int move = 0; move < static_cast<int>(timeline.size()); move++) {
+        if (!timeline[move].has_value())
+            continue;
+
+        double lead = std::clamp(timeline[move].value(), -TIMELINE_SCORE_RANGE, TIMELINE_SCORE_RANGE);
+        float bar_h = std::abs(lead) / TIMELINE_SCORE_RANGE * (area.h / 2);
+
+        SDL_Color color = lead > 0 ? theme.black_color : theme.white_color;
+        SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, 255);
+
+        SDL_FRect rect = {
+            area.x + move * bar_w,
+            lead > 0 ? middle_y - bar_h : middle_y,
+            std::max(bar_w, 1.f),
+            bar_h
+        };
+        SDL_RenderFillRect(renderer, &rect);
+    }
+
+    SDL_Color text_color = theme.text_color;
+    SDL_SetRenderDrawColor(renderer, text_color.r, text_color.g, text_color.b, 255);
+    DrawStraightLine(renderer, area.x, middle_y, area.x + area.w, middle_y);
+
+    if (current_move >= 0 && current_move < static_cast<int>(timeline.size())) {
+        float current_x = area.x + (current_move + 0.5f) * bar_w;
+        DrawStraightLine(renderer, current_x, area.y, current_x, area.y + area.h, 2);
+    }
+}
+
 void GoDrawHelper::DrawText (TTF_TextEngine* text_engine, TTF_Font* font, SDL_Color col, std::pair<int, int> point, std::string str, int font_size, GoTextAlign align) {
     TTF_SetFontSize(font, font_size);
     TTF_Text *text = TTF_CreateText(text_engine, font, str.c_str(), str.size());
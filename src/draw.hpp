@@ -14,10 +14,15 @@
 #include <SDL3/SDL_render.h>
 #include <SDL3_ttf/SDL_ttf.h>
 #include <cmath>
+#include <optional>
 #include <string>
+#include <vector>
 
 #define ERROR_TEXT_MAX_WIDTH 500
 
+// Score lead that fills half the height of the review timeline
+#define TIMELINE_SCORE_RANGE 20.0
+
 class GoDrawHelper {
 public:
     static void DrawError (
@@ -34,6 +39,15 @@ public:
     static void DrawStraightLine (SDL_Renderer* renderer, float ax, float ay, float bx, float by);
     static void DrawOwnershipCell (SDL_Renderer* renderer, GoBoardInfo board, std::pair<int, int> cell, double value);
     static void DrawBoard (SDL_Renderer* renderer, GoBoardInfo board);
+
+    // Score lead after each move as bars around the middle of area, black
+    // leads up and white leads down. Moves not analysed yet are left out.
+    static void DrawScoreTimeline (
+        SDL_Renderer* renderer,
+        SDL_FRect area,
+        const std::vector<std::optional<double>>& timeline,
+        int current_move
+    );
     static void DrawText (
         TTF_TextEngine* text_engine,
         std::pair<int, int> point,
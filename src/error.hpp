@@ -46,7 +46,7 @@ const std::unordered_map<GoErrorEnum, GoError> GO_ERRORS = {
     {GoErrorEnum::ENGINE_CONFIG_FILE_NOT_FOUND, {GoErrorSeverity::WARNING, "Engine config file not found, Engine failed to load"}},
     {GoErrorEnum::ENGINE_MODEL_FILE_NOT_FOUND, {GoErrorSeverity::WARNING, "Engine model file not found, Engine failed to load"}},
     {GoErrorEnum::ENGINE_BUSY, {GoErrorSeverity::WARNING, "Engine is busy"}},
-    {GoErrorEnum::ENGINE_NOT_USABLE, {GoErrorSeverity::WARNING, "Engine parse error, disabling it for now."}},
+    {GoErrorEnum::ENGINE_NOT_USABLE, {GoErrorSeverity::WARNING, "Engine gave no usable answer, skipping it."}},
     {GoErrorEnum::GAME_IN_KO, {GoErrorSeverity::WARNING, "The game is in KO, play elsewhere first."}}
 };
 
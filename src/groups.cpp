@@ -0,0 +1,177 @@
+#include "groups.hpp"
+
+int GoGroupTable::merge (int root, int other) {
+    if (stone_count[root] < stone_count[other]) {
+        std::swap(root, other);
+    }
+
+    forEachStone(other, [&](int point) {
+        group_of[point] = root;
+    });
+
+    // Splice the two circular lists together
+    std::swap(next_stone[root], next_stone[other]);
+
+    stone_count[root] += stone_count[other];
+    liberties[root] |= liberties[other];
+    return root;
+}
+
+template <typename Geometry>
+void GoGroupTable::rebuildGroup (const GoBoardPosition& board, const Geometry& geometry, int start_point) {
+    GoBoardCellState target = board.at(start_point);
+    const std::array<int, 4> offsets = geometry.getNeighbourOffsets();
+
+    // group_of may still hold the old root here, so track visits separately
+    std::array<bool, GO_MAX_POINTS> visited = {};
+    std::array<int, GO_MAX_BOARD_DIM * GO_MAX_BOARD_DIM> stack;
+    int top = 0;
+
+    stack[top++] = start_point;
+    visited[start_point] = true;
+    group_of[start_point] = start_point;
+    next_stone[start_point] = start_point;
+    stone_count[start_point] = 0;
+    liberties[start_point].clear();
+
+    while (top > 0) {
+        int point = stack[--top];
+        stone_count[start_point]++;
+
+        if (point != start_point) {
+            next_stone[point] = next_stone[start_point];
+            next_stone[start_point] = point;
+        }
+
+        for (int offset : offsets) {
+            int next = point + offset;
+            GoBoardCellState cell = board.at(next);
+
+            if (cell == GoBoardCellState::EMPTY) {
+                liberties[start_point].set(geometry.pointToIndex(next));
+            } else if (cell == target && !visited[next]) {
+                visited[next] = true;
+                group_of[next] = start_point;
+                stack[top++] = next;
+            }
+        }
+    }
+}
+
+template <typename Geometry>
+void GoGroupTable::build (const GoBoardPosition& board, const Geometry& geometry) {
+    group_of.fill(GO_NO_GROUP);
+
+    int size = geometry.getSize();
+    for (int x = 0; x < size; x++) {
+        for (int y = 0; y < size; y++) {
+            int point = geometry.toPoint(x, y);
+            GoBoardCellState cell = board.at(point);
+            if (cell != GoBoardCellState::EMPTY && group_of[point] == GO_NO_GROUP) {
+                rebuildGroup(board, geometry, point);
+            }
+        }
+    }
+}
+
+template <typename Geometry>
+void GoGroupTable::place (GoBoardPosition& board, const Geometry& geometry, int point, GoTurn turn) {
+    GoBoardCellState own = getCellStateFromTurn(turn);
+    const std::array<int, 4> offsets = geometry.getNeighbourOffsets();
+    int index = geometry.pointToIndex(point);
+
+    board.setAt(point, index, own);
+    group_of[point] = point;
+    next_stone[point] = point;
+    stone_count[point] = 1;
+    liberties[point].clear();
+
+    for (int offset : offsets) {
+        if (board.at(point + offset) == GoBoardCellState::EMPTY) {
+            liberties[point].set(geometry.pointToIndex(point + offset));
+        }
+    }
+
+    int root = point;
+    for (int offset : offsets) {
+        int next = point + offset;
+        GoBoardCellState cell = board.at(next);
+        if (cell == GoBoardCellState::EMPTY || cell == GoBoardCellState::OFFBOARD)
+            continue;
+
+        int next_root = group_of[next];
+        if (cell != own) {
+            liberties[next_root].reset(index);
+        } else if (next_root != root) {
+            root = merge(root, next_root);
+        }
+    }
+
+    liberties[root].reset(index);
+}
+
+template <typename Geometry>
+void GoGroupTable::remove (GoBoardPosition& board, const Geometry& geometry, const std::vector<int>& points) {
+    const std::array<int, 4> offsets = geometry.getNeighbourOffsets();
+
+    // Stones of the touched groups that stay on the board
+    std::vector<int> survivors;
+    std::vector<int> touched_roots;
+    for (int point : points) {
+        int root = group_of[point];
+        if (root == GO_NO_GROUP) continue;
+
+        bool is_seen = false;
+        for (int touched : touched_roots) {
+            if (touched == root) {
+                is_seen = true;
+                break;
+            }
+        }
+        if (!is_seen) touched_roots.push_back(root);
+    }
+
+    for (int point : points) {
+        board.setAt(point, geometry.pointToIndex(point), GoBoardCellState::EMPTY);
+        group_of[point] = GO_NO_GROUP;
+    }
+
+    for (int root : touched_roots) {
+        forEachStone(root, [&](int point) {
+            if (group_of[point] != GO_NO_GROUP) {
+                survivors.push_back(point);
+            }
+        });
+    }
+
+    // Captured groups leave no survivors, an undone placement may split
+    std::array<bool, GO_MAX_POINTS> rebuilt = {};
+    for (int point : survivors) {
+        if (rebuilt[point]) continue;
+
+        rebuildGroup(board, geometry, point);
+        forEachStone(point, [&](int stone) {
+            rebuilt[stone] = true;
+        });
+    }
+
+    for (int point : points) {
+        int index = geometry.pointToIndex(point);
+        for (int offset : offsets) {
+            int next = point + offset;
+            if (group_of[next] != GO_NO_GROUP) {
+                liberties[group_of[next]].set(index);
+            }
+        }
+    }
+}
+
+#define GO_INSTANTIATE_GROUP_KERNELS(Geometry) \
+    template void GoGroupTable::build<Geometry> (const GoBoardPosition&, const Geometry&); \
+    template void GoGroupTable::place<Geometry> (GoBoardPosition&, const Geometry&, int, GoTurn); \
+    template void GoGroupTable::remove<Geometry> (GoBoardPosition&, const Geometry&, const std::vector<int>&);
+
+GO_INSTANTIATE_GROUP_KERNELS(GoPosition<9>)
+GO_INSTANTIATE_GROUP_KERNELS(GoPosition<13>)
+GO_INSTANTIATE_GROUP_KERNELS(GoPosition<19>)
+GO_INSTANTIATE_GROUP_KERNELS(GoBoardPosition)
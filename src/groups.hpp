@@ -0,0 +1,67 @@
+#ifndef GO_GROUPS_H
+#define GO_GROUPS_H
+
+#include "base.hpp"
+#include "position.hpp"
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#define GO_NO_GROUP -1
+
+// Chains of a GoBoardPosition, kept up to date on every placement and removal.
+// Every stone points straight at its group's root (find is O(1)) and a union
+// relabels the smaller group into the larger one. Roots own a circular list
+// of their stones, the stone count and the liberty set as a bitboard.
+class GoGroupTable {
+    std::array<int16_t, GO_MAX_POINTS> group_of;
+    std::array<int16_t, GO_MAX_POINTS> next_stone;
+    std::array<int16_t, GO_MAX_POINTS> stone_count;
+    std::array<GoBitboard, GO_MAX_POINTS> liberties;
+
+    int merge (int root, int other);
+
+    template <typename Geometry>
+    void rebuildGroup (const GoBoardPosition& board, const Geometry& geometry, int start_point);
+
+public:
+    GoGroupTable () { group_of.fill(GO_NO_GROUP); }
+
+    // The kernels below take the board geometry separately: either a
+    // GoPosition<N> for the supported sizes or the GoBoardPosition itself.
+    // They are instantiated in groups.cpp and picked by withBoardGeometry().
+
+    // Recomputes every group from scratch
+    template <typename Geometry>
+    void build (const GoBoardPosition& board, const Geometry& geometry);
+
+    // Puts a stone on an empty point, merging friendly neighbours and
+    // taking the point away from enemy liberties. Does not capture.
+    template <typename Geometry>
+    void place (GoBoardPosition& board, const Geometry& geometry, int point, GoTurn turn);
+
+    // Empties the given points. Used both for captures and for undoing a
+    // placement, in which case the remaining stones may split into new groups.
+    template <typename Geometry>
+    void remove (GoBoardPosition& board, const Geometry& geometry, const std::vector<int>& points);
+
+    int getGroup (int point) const { return group_of[point]; }
+    int getStoneCount (int root) const { return stone_count[root]; }
+    int getLibertyCount (int root) const { return liberties[root].count(); }
+    const GoBitboard& getLiberties (int root) const { return liberties[root]; }
+
+    bool isInAtari (int point) const {
+        return group_of[point] != GO_NO_GROUP && getLibertyCount(group_of[point]) == 1;
+    }
+
+    template <typename Fn>
+    void forEachStone (int root, Fn&& fn) const {
+        int point = root;
+        do {
+            fn(point);
+            point = next_stone[point];
+        } while (point != root);
+    }
+};
+
+#endif
@@ -5,8 +5,11 @@
 #include "helpers.hpp"
 #include "katago_engine.hpp"
 #include "katago_settings.hpp"
+#include "rules.hpp"
+#include "state.hpp"
 #include "utils.hpp"
 #include <SDL3/SDL_log.h>
+#include <algorithm>
 #include <cassert>
 #include <memory>
 #include <optional>
@@ -19,76 +22,52 @@ std::vector<std::string> parseMove (json response) {
     };
 }
 
-std::vector<std::vector<std::string>> getMoves (GoBoardSize size, std::vector<GoBoardAction> actions) {
-    std::vector<std::vector<std::string>> moves;
-    for (int i = 0; i < actions.size(); i++) {
-        auto action = actions[i];
-
-        // Can be a GoStone or GoTurn -> GoTurn is pass
-        std::optional<std::variant<GoStone, GoTurn>> stone_opt =
-            std::visit([&](auto&& action) -> std::optional<std::variant<GoStone, GoTurn>> {
-                using T = std::decay_t<decltype(action)>;
-
-                if constexpr (std::is_same_v<T, AddStoneAction>) {
-                    return std::make_optional<GoStone>(action.stone);
-                }
-                else if constexpr (std::is_same_v<T, CaptureStonesAction>) {
-                    return std::make_optional<GoStone>(action.capturing_stone);
-                }
-                else if constexpr (std::is_same_v<T, PassAction>) {
-                    return std::make_optional<GoTurn>(action.turn);
-                }
-
-                return std::nullopt;
-            }, action);
-
-        if (stone_opt.has_value()) {
-            Result<std::vector<std::string>, GoErrorEnum> move_opt =
-                std::visit([&](auto&& go_move) -> Result<std::vector<std::string>, GoErrorEnum> {
-                    using T = std::decay_t<decltype(go_move)>;
-
-                    if constexpr (std::is_same_v<T, GoStone>) {
-                        return Ok(stoneToKatagoMove(size, go_move));
-                    }
-                    else if constexpr (std::is_same_v<T, GoTurn>) {
-                        return Ok(std::vector<std::string>{
-                            go_move == GoTurn::BLACK ?
-                                "B" : "W",
-                            "pass"
-                        });
-                    }
-
-                    return Err(GoErrorEnum::UNPARSEABLE_MOVE);
-                }, stone_opt.value());
-
-            if (move_opt.is_ok()) {
-                moves.push_back(move_opt.ok_value());
-            }
-        }
-    }
-    return moves;
-}
-
-KataGo::KataGo(
+KataGoService::KataGoService(
     bool is_disabled,
     const std::string& katago_path,
     const std::string& config_path,
     const std::string& model_path,
-    GoBoardSize size
+    const std::string& analysis_cache_path,
+    size_t analysis_cache_max_bytes,
+    int process_count
 ) {
-    this->is_disabled = is_disabled;
-    if (!this->is_disabled) {
+    this->disk_cache = std::make_unique<KataGoDiskCache>(analysis_cache_path, analysis_cache_max_bytes);
+
+    // Indexing a large file takes a while, lookups miss until it is done
+    this->disk_cache->loadInBackground();
+
+    if (!is_disabled) {
+        KataGoSettings::load();
+        this->settings_watcher = std::make_unique<KataGoSettingsWatcher>();
+
         this->engine =
-            std::make_unique<KataGoEngine>(
+            std::make_unique<KataGoEnginePool>(
                 katago_path,
                 config_path,
                 model_path,
+                process_count,
                 [&](bool is_failure) {
                     is_init_failure = is_failure;
                 }
             );
     }
-    this->size = size;
+}
+
+KataGoService::~KataGoService() {
+    // Stops the reader threads before the caches that pending response
+    // handlers write to are destroyed
+    this->engine.reset();
+}
+
+KataGo::KataGo(std::shared_ptr<KataGoService> service, GoBoardSize size):
+    size(size),
+    service(service),
+    engine(service->engine.get()),
+    evaluation_cache(service->evaluation_cache),
+    disk_cache(service->disk_cache.get())
+{
+    this->is_init_failure = service->is_init_failure;
+    this->is_disabled = engine == nullptr;
 }
 
 void KataGo::updateDiffLevel (int diff_lvl) {
@@ -98,36 +77,45 @@ void KataGo::updateDiffLevel (int diff_lvl) {
 
 std::optional<std::variant<GoStone, GoTurn>>
 KataGo::nextNMoves (
-    std::vector<GoBoardAction> actions, int n
+    GoGameLine line, int n,
+    std::vector<GoStone> avoid_moves
 ) {
-    if (is_init_failure || is_disabled)
+    if (is_init_failure || isDisabled())
         return std::nullopt;
 
+    uint64_t generation = beginQuery(move_slot);
     is_busy.store(true);
     std::optional<std::variant<GoStone, GoTurn>> go_move_opt = std::nullopt;
-    std::lock_guard<std::mutex> lock(work_mutex);
     try {
 
-        std::vector<std::vector<std::string>> moves =
-            getMoves(this->size, actions);
+        KataGoMoves moves = getMovesText(line);
 
+        // Moves generated here go after the shared ones
+        std::string played;
         while (n--) {
-            std::string id = genRandomString(5);
-            json query = getMoveQuery(id, moves, size);
+            KataGoQuery query = getMoveQuery(engine->nextQueryId(), size, avoid_moves);
+            avoid_moves.clear();
             KataGoSettings::applyDiffLevel(query, getLevel(this->diff_lvl));
+            query.next_moves = played;
 
-            engine->sendJSON(query);
+            std::optional<std::vector<std::string>> next_move_opt = std::nullopt;
+            if (trackQuery(move_slot, generation, query.id)) {
+                next_move_opt = engine->getNextMove(query, moves);
+            }
 
-            std::optional<std::vector<std::string>>
-                next_move_opt = engine->getNextMove();
+            if (!finishQuery(move_slot, generation)) {
+                go_move_opt = std::nullopt;
+                break;
+            }
 
             if (!next_move_opt.has_value()) {
-                is_disabled = true;
+                // One bad answer, the pool keeps the processes going
+                is_busy.store(false);
                 return std::nullopt;
             }
 
             std::vector<std::string> next_move = next_move_opt.value();
-            moves.push_back(next_move);
+            appendKataGoMove(played, next_move[0], next_move[1]);
 
             if (next_move[1] != "pass") {
                 GoStone stone = katagoMoveToStone(this->size, next_move);
@@ -150,26 +138,65 @@ KataGo::nextNMoves (
     return go_move_opt;
 }
 
+KataGoMoves KataGo::getMovesText (const GoGameLine& line) {
+    std::lock_guard<std::mutex> lock(moves_mutex);
+    return line_moves.update(size, line);
+}
+
+KataGoQuery KataGo::getEvaluationQueryFor (const GoGameNode* node, KataGoEvaluationKey& key) {
+    KataGoQuery query = getEvaluationQuery("", size);
+    KataGoSettings::applyEvaluationConfig(query);
+
+    key = KataGoEvaluationKey::fromQuery(node->hash.position, node->getTurnToPlay(), query);
+    return query;
+}
+
 std::optional<KataGoEvaluation>
-KataGo::getEvaluation (std::vector<GoBoardAction> actions) {
-    if (is_init_failure || is_disabled)
-        return std::nullopt;
+KataGo::getStoredEvaluation (const KataGoEvaluationKey& key) {
+    std::optional<KataGoEvaluation> evaluation = evaluation_cache.get(key);
+    if (evaluation.has_value())
+        return evaluation;
 
-    std::lock_guard<std::mutex> lock(work_mutex);
-    std::optional<KataGoEvaluation> evaluation = std::nullopt;
-    try {
-        std::vector<std::vector<std::string>> moves =
-            getMoves(this->size, actions);
+    evaluation = disk_cache->get(key);
+    if (evaluation.has_value()) {
+        evaluation_cache.put(key, evaluation.value());
+    }
+    return evaluation;
+}
+
+std::optional<KataGoEvaluation>
+KataGo::getEvaluation (
+    GoGameLine line,
+    std::function<void(const KataGoEvaluation&)> on_partial
+) {
+    KataGoEvaluationKey key;
+    KataGoQuery query = getEvaluationQueryFor(line.get(), key);
 
-        std::string id = genRandomString(5);
-        json query = getEvaluationQuery(id, moves, size);
-        KataGoSettings::applyEvaluationConfig(query);
+    std::optional<KataGoEvaluation> evaluation = getStoredEvaluation(key);
+    if (evaluation.has_value() || is_init_failure || isDisabled())
+        return evaluation;
+
+    uint64_t generation = beginQuery(evaluation_slot);
+    try {
+        query.id = engine->nextQueryId();
+        KataGoMoves moves = getMovesText(line);
+        if (on_partial) {
+            query.report_during_search_every = KATAGO_REPORT_DURING_SEARCH_EVERY;
+        }
 
-        engine->sendJSON(query);
+        if (trackQuery(evaluation_slot, generation, query.id)) {
+            evaluation = engine->getEvaluation(query, moves, on_partial);
+        }
 
-        evaluation = engine->getEvaluation();
-        if (!evaluation.has_value()) {
-            is_disabled = true;
+        if (!finishQuery(evaluation_slot, generation)) {
+            // Superseded by a newer position
+            if (evaluation.has_value()) {
+                evaluation_cache.put(key, evaluation.value());
+            }
+            return std::nullopt;
+        } else if (evaluation.has_value()) {
+            evaluation_cache.put(key, evaluation.value());
+            disk_cache->put(key, evaluation.value());
         }
     } catch (const json::parse_error& err) {
         std::cerr << "Parse error for invalid JSON: " << err.what() << std::endl;
@@ -179,6 +206,286 @@ KataGo::getEvaluation (std::vector<GoBoardAction> actions) {
     return evaluation;
 }
 
+std::optional<KataGoEvaluation>
+KataGo::getCachedEvaluation (const GoGameNode* node) {
+    KataGoEvaluationKey key;
+    getEvaluationQueryFor(node, key);
+    return getStoredEvaluation(key);
+}
+
+uint64_t KataGo::beginQuery (KataGoQuerySlot& slot) {
+    std::string stale;
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(query_mutex);
+        stale.swap(slot.id);
+        generation = ++slot.generation;
+    }
+
+    if (!stale.empty() && engine) {
+        engine->cancel(stale);
+    }
+    return generation;
+}
+
+bool KataGo::trackQuery (KataGoQuerySlot& slot, uint64_t generation, const std::string& id) {
+    std::lock_guard<std::mutex> lock(query_mutex);
+    if (slot.generation != generation)
+        return false;
+
+    slot.id = id;
+    return true;
+}
+
+bool KataGo::finishQuery (KataGoQuerySlot& slot, uint64_t generation) {
+    std::lock_guard<std::mutex> lock(query_mutex);
+    if (slot.generation != generation)
+        return false;
+
+    // Answered, nothing left to terminate
+    slot.id.clear();
+    return true;
+}
+
+void KataGo::cancelEvaluation () {
+    beginQuery(evaluation_slot);
+}
+
+void KataGo::cancelMoveGeneration () {
+    beginQuery(move_slot);
+}
+
+void KataGo::speculate (GoGameLine line, const GoBoardStateComputed& computed, const KataGoEvaluation& evaluation) {
+    cancelSpeculation();
+    if (is_init_failure || isDisabled())
+        return;
+
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(query_mutex);
+        generation = speculation_generation;
+    }
+
+    KataGoEvaluationKey key;
+    KataGoQuery query = getEvaluationQueryFor(line.get(), key);
+    KataGoMoves moves = getMovesText(line);
+    query.priority = KATAGO_SPECULATIVE_PRIORITY;
+
+    GoTurn turn = line->getTurnToPlay();
+    std::string player = turn == GoTurn::BLACK ? "B" : "W";
+    int board_size = static_cast<int>(this->size);
+
+    int count = std::min<int>(evaluation.candidates.size(), KATAGO_SPECULATIVE_CANDIDATES);
+    for (int i = 0; i < count; i++) {
+        const std::string& move = evaluation.candidates[i].move;
+
+        GoPositionHash hash;
+        if (move == "pass") {
+            hash = getPositionHash(computed.getPosition().getHash(), getOppositeTurn(turn));
+        } else {
+            GoStone stone = katagoMoveToStone(this->size, {player, move});
+            if (stone.x < 0 || stone.x >= board_size || stone.y < 0 || stone.y >= board_size
+                    || computed.get(stone.x, stone.y) != GoBoardCellState::EMPTY) {
+                continue;
+            }
+
+            std::vector<GoStone> removed_stones;
+            for (auto group : GoBoardRuleManager::getCapturedGroups(computed, stone)) {
+                removed_stones.insert(removed_stones.end(), group.begin(), group.end());
+            }
+            hash = computed.getHashAfter(stone, removed_stones);
+        }
+
+        KataGoEvaluationKey child_key = KataGoEvaluationKey::fromQuery(hash.position, getOppositeTurn(turn), query);
+        if (getStoredEvaluation(child_key).has_value())
+            continue;
+
+        // Every child is sent with the moves of the line and one more
+        KataGoQuery child_query = query;
+        child_query.id = engine->nextQueryId();
+        appendKataGoMove(child_query.next_moves, player, move);
+
+        std::string id = child_query.id;
+        {
+            // The user moved on while the children were being queued
+            std::lock_guard<std::mutex> lock(query_mutex);
+            if (speculation_generation != generation)
+                return;
+            speculative_ids.push_back(id);
+        }
+
+        engine->query(child_query, moves, [this, self = shared_from_this(), child_key, id](const KataGoResponse& response) {
+            if (response.is_during_search)
+                return false;
+
+            if (KataGoEngine::isEvaluation(response)) {
+                KataGoEvaluation child = KataGoEngine::parseEvaluation(response).value();
+                evaluation_cache.put(child_key, child);
+                disk_cache->put(child_key, child);
+            }
+
+            std::lock_guard<std::mutex> lock(query_mutex);
+            speculative_ids.erase(std::remove(speculative_ids.begin(), speculative_ids.end(), id), speculative_ids.end());
+            return true;
+        });
+    }
+}
+
+void KataGo::cancelSpeculation () {
+    std::vector<std::string> stale;
+    {
+        std::lock_guard<std::mutex> lock(query_mutex);
+        stale.swap(speculative_ids);
+        speculation_generation++;
+    }
+
+    if (!engine)
+        return;
+
+    for (const std::string& id : stale) {
+        engine->cancel(id);
+    }
+}
+
+bool KataGo::reviewGame (GoGameLine line) {
+    if (is_init_failure || isDisabled())
+        return false;
+
+    std::vector<const GoGameNode*> nodes(line->move_number + 1);
+    for (const GoGameNode* node = line.get(); node; node = node->parent.get()) {
+        nodes[node->move_number] = node;
+    }
+
+    KataGoEvaluationKey key;
+    KataGoQuery query = getEvaluationQueryFor(line.get(), key);
+
+    std::vector<std::optional<double>> timeline(nodes.size());
+    std::vector<int> turns;
+    for (size_t turn = 0; turn < nodes.size(); turn++) {
+        key = KataGoEvaluationKey::fromQuery(nodes[turn]->hash.position, nodes[turn]->getTurnToPlay(), query);
+
+        std::optional<KataGoEvaluation> evaluation = getStoredEvaluation(key);
+        if (evaluation.has_value()) {
+            timeline[turn] = evaluation->score;
+        } else {
+            turns.push_back(turn);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(review_mutex);
+        if (review_progress.isRunning())
+            return false;
+
+        review_timeline = timeline;
+        review_progress = {static_cast<int>(nodes.size() - turns.size()), static_cast<int>(nodes.size())};
+    }
+
+    if (turns.empty())
+        return true;
+
+    KataGoMoves moves = getMovesText(line);
+
+    // Turns are dealt out in turn, so that every process gets a share of
+    // the long endgame positions
+    int chunk_count = std::min<int>(engine->getSize(), turns.size());
+    for (int chunk = 0; chunk < chunk_count; chunk++) {
+        std::vector<int> chunk_turns;
+        for (size_t i = chunk; i < turns.size(); i += chunk_count) {
+            chunk_turns.push_back(turns[i]);
+        }
+
+        KataGoQuery chunk_query = query;
+        chunk_query.id = engine->nextQueryId();
+        chunk_query.analyze_turns = chunk_turns;
+        reviewTurns(line, nodes, chunk_query, moves, chunk_turns.size());
+    }
+
+    return true;
+}
+
+void KataGo::reviewTurns (
+    GoGameLine line,
+    const std::vector<const GoGameNode*>& nodes,
+    const KataGoQuery& query,
+    KataGoMoves moves,
+    int turn_count
+) {
+    // One response per turn, in whatever order KataGo finishes them. The
+    // line keeps the nodes alive until the last one is in.
+    std::string id = query.id;
+    {
+        std::lock_guard<std::mutex> lock(review_mutex);
+        review_ids.push_back(id);
+    }
+
+    engine->query(query, moves, [this, self = shared_from_this(), id, line, nodes, query, remaining = turn_count] (const KataGoResponse& response) mutable {
+        if (!response.error.empty()) {
+            // The turns of this query are given up on, the others go on
+            SDL_Log("[Review failed] %s", response.error.c_str());
+            std::lock_guard<std::mutex> lock(review_mutex);
+            review_progress.analysed += remaining;
+            review_ids.erase(std::remove(review_ids.begin(), review_ids.end(), id), review_ids.end());
+            return true;
+        }
+
+        int turn = response.turn_number;
+        std::optional<KataGoEvaluation> evaluation = KataGoEngine::parseEvaluation(response);
+        if (turn >= 0 && turn < static_cast<int>(nodes.size()) && evaluation.has_value()) {
+            KataGoEvaluationKey key = KataGoEvaluationKey::fromQuery(
+                nodes[turn]->hash.position, nodes[turn]->getTurnToPlay(), query
+            );
+            evaluation_cache.put(key, evaluation.value());
+            disk_cache->put(key, evaluation.value());
+        }
+
+        // A turn that failed to parse is left empty but still counted
+        std::lock_guard<std::mutex> lock(review_mutex);
+        if (turn >= 0 && turn < static_cast<int>(nodes.size()) && evaluation.has_value()) {
+            review_timeline[turn] = evaluation->score;
+        }
+        review_progress.analysed++;
+
+        if (--remaining > 0)
+            return false;
+
+        review_ids.erase(std::remove(review_ids.begin(), review_ids.end(), id), review_ids.end());
+        return true;
+    });
+}
+
+void KataGo::cancelReview () {
+    std::vector<std::string> stale;
+    {
+        std::lock_guard<std::mutex> lock(review_mutex);
+        stale.swap(review_ids);
+        review_progress.total = review_progress.analysed;
+    }
+
+    for (const std::string& id : stale) {
+        engine->cancel(id);
+    }
+}
+
+void KataGo::stop () {
+    cancelEvaluation();
+    cancelMoveGeneration();
+    cancelSpeculation();
+    if (engine) {
+        cancelReview();
+    }
+}
+
+KataGoReviewProgress KataGo::getReviewProgress () {
+    std::lock_guard<std::mutex> lock(review_mutex);
+    return review_progress;
+}
+
+std::vector<std::optional<double>> KataGo::getReviewTimeline () {
+    std::lock_guard<std::mutex> lock(review_mutex);
+    return review_timeline;
+}
+
 bool KataGo::isBusy () {
     return this->is_busy.load();
 }
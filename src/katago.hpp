@@ -3,134 +3,271 @@
 
 #include "actions.hpp"
 #include "base.hpp"
+#include "tree.hpp"
 #include "json.hpp"
+#include "katago_cache.hpp"
+#include "katago_disk_cache.hpp"
 #include "katago_engine.hpp"
+#include "katago_pool.hpp"
+#include "katago_query.hpp"
 #include "katago_settings.hpp"
+#include "state.hpp"
 #include <SDL3/SDL_log.h>
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <string>
+#include <variant>
 #include <vector>
 
 using nlohmann::json;
 
-inline json getMoveQuery (
+inline GoStone katagoMoveToStone (GoBoardSize size, std::vector<std::string> move) {
+    GoTurn turn = move[0] == "B" ? GoTurn::BLACK : GoTurn::WHITE;
+
+    int y = move[1][0] - 'A';
+    if (move[1][0] > 'I') y--;
+
+    std::string x_string = std::string(move[1].begin()+1, move[1].end());
+    int x = static_cast<int>(size) - std::stoi(x_string);
+
+    return {turn, x, y};
+}
+
+inline std::vector<std::string> stoneToKatagoMove (GoBoardSize size, GoStone stone) {
+    std::string pos;
+    if (stone.y >= 8) stone.y++;
+    pos.push_back('A' + stone.y);
+    pos += std::to_string(static_cast<int>(size) - stone.x);
+    return {
+        stone.turn == GoTurn::BLACK ? "B" : "W",
+        pos
+    };
+}
+
+// Queries are built without their moves, which are sent along from a
+// KataGoMoveList
+inline KataGoQuery getMoveQuery (
     std::string id,
-    std::vector<std::vector<std::string>> moves,
-    GoBoardSize size
+    GoBoardSize size,
+    const std::vector<GoStone>& avoid_moves = {}
 ) {
-    int board_size =
-        static_cast<int>(size);
-
-    json req;
+    KataGoQuery query;
 
-    req["id"] = id;
-    req["moves"] = moves.size() > 0 ?
-        moves :
-        std::vector<std::vector<std::string>>(0);
+    query.id = id;
+    query.board_size = static_cast<int>(size);
 
-    req["rules"] = "japanese";
-    req["komi"] = 6.5;
+    // Points our ko rule forbids but KataGo's might not, for the next move only
+    if (avoid_moves.size() > 0) {
+        KataGoAvoidMoves avoid;
+        avoid.player = avoid_moves[0].turn == GoTurn::BLACK ? "B" : "W";
+        for (const GoStone& stone : avoid_moves) {
+            avoid.moves.push_back(stoneToKatagoMove(size, stone)[1]);
+        }
+        avoid.until_depth = 1;
 
-    req["boardXSize"] = board_size;
-    req["boardYSize"] = board_size;
+        query.avoid_moves.push_back(avoid);
+    }
 
-    return req;
+    return query;
 }
 
-// Cache this? KataGo takes time to respond
-// Better to jst calculate it yourself
-inline json getEvaluationQuery (
+// Seconds between the snapshots of a streamed evaluation
+#define KATAGO_REPORT_DURING_SEARCH_EVERY 0.05
+
+// Answers are cached by position, see KataGoEvaluationCache
+inline KataGoQuery getEvaluationQuery (
     std::string id,
-    std::vector<std::vector<std::string>> moves,
     GoBoardSize size
 ) {
-    int board_size =
-        static_cast<int>(size);
+    KataGoQuery query;
 
-    json req;
+    query.id = id;
+    query.board_size = static_cast<int>(size);
 
-    req["id"] = id;
-    req["moves"] = moves.size() > 0 ?
-        moves :
-        std::vector<std::vector<std::string>>(0);
+    query.max_visits = 20;
+    query.root_policy_temperature = 0.3;
+    query.root_fpu_reduction_max = 0.5;
 
-    req["rules"] = "japanese";
-    req["komi"] = 6.5;
+    query.include_ownership = true;
 
-    req["boardXSize"] = board_size;
-    req["boardYSize"] = board_size;
+    return query;
+}
 
-    req["maxVisits"] = 20;
-    req["rootPolicyTemperature"] = 0.3;
-    req["rootFpuReductionMax"] = 0.5;
+std::vector<std::string> parseMove (json katago_resp);
 
-    req["includeOwnership"] = true;
+// Top candidates of an evaluated position whose children are analysed ahead
+// of the next move, below the priority of anything the user waits for
+#define KATAGO_SPECULATIVE_CANDIDATES 5
+#define KATAGO_SPECULATIVE_PRIORITY -1
+
+// The one query of a kind the engine should be working on. Each request
+// takes a new generation, which supersedes and terminates the query of the
+// one before.
+struct KataGoQuerySlot {
+    std::string id;
+    uint64_t generation = 0;
+};
 
-    return req;
-}
+struct KataGoReviewProgress {
+    int analysed;
+    int total;
 
-std::vector<std::string> parseMove (json katago_resp);
-std::vector<std::vector<std::string>> getMoves (GoBoardSize size, std::vector<GoBoardAction> actions);
+    bool isRunning () const { return analysed < total; }
+};
 
-inline GoStone katagoMoveToStone (GoBoardSize size, std::vector<std::string> move) {
-    GoTurn turn = move[0] == "B" ? GoTurn::BLACK : GoTurn::WHITE;
+// What outlives a board: the KataGo processes, with their model loaded
+// once, and the evaluation caches. Queries carry their own board size, so
+// boards of every size share one service.
+class KataGoService {
+public:
+    std::unique_ptr<KataGoEnginePool> engine = nullptr;
+    bool is_init_failure = false;
 
-    int y = move[1][0] - 'A';
-    if (move[1][0] > 'I') y--;
+    KataGoEvaluationCache evaluation_cache;
 
-    std::string x_string = std::string(move[1].begin()+1, move[1].end());
-    int x = static_cast<int>(size) - std::stoi(x_string);
+    // Survives restarts and answers even when the engine is missing
+    std::unique_ptr<KataGoDiskCache> disk_cache;
 
-    return {turn, x, y};
-}
+    // Read once here, queries only use the loaded snapshot
+    std::unique_ptr<KataGoSettingsWatcher> settings_watcher;
 
-inline std::vector<std::string> stoneToKatagoMove (GoBoardSize size, GoStone stone) {
-    std::string pos;
-    if (stone.y >= 8) stone.y++;
-    pos.push_back('A' + stone.y);
-    pos += std::to_string(static_cast<int>(size) - stone.x);
-    return {
-        stone.turn == GoTurn::BLACK ? "B" : "W",
-        pos
-    };
-}
+    // Without is_disabled the processes start here, once
+    KataGoService(
+        bool is_disabled,
+        const std::string& katago_path,
+        const std::string& config_path,
+        const std::string& model_path,
+        const std::string& analysis_cache_path = "",
+        size_t analysis_cache_max_bytes = 0,
+        int process_count = 1
+    );
+
+    ~KataGoService();
 
-class KataGo {
+    KataGoService(const KataGoService&) = delete;
+    KataGoService& operator=(const KataGoService&) = delete;
+};
+
+// The engine as one board sees it. Response handlers hold a reference to
+// their KataGo, so stop() before dropping it lets it go at once.
+class KataGo: public std::enable_shared_from_this<KataGo> {
 private:
     GoBoardSize size;
-    std::unique_ptr<KataGoEngine> engine = nullptr;
+    std::shared_ptr<KataGoService> service;
+
+    // Borrowed from the service
+    KataGoEnginePool* engine;
+    KataGoEvaluationCache& evaluation_cache;
+    KataGoDiskCache* disk_cache;
 
-    std::mutex work_mutex;
+    // Set while a move is being generated. Queries no longer wait for each
+    // other, the engine routes every response by its id.
     std::atomic<bool> is_busy = {false};
 
     bool is_init_failure = false;
-    bool is_disabled = false;
+    std::atomic<bool> is_disabled = {false};
 
     int diff_lvl = 5; // 5,4,3,2,1
 
-public:
-    KataGo(
-        bool is_disabled,
-        const std::string& katago_path,
-        const std::string& config_path,
-        const std::string& model_path,
-        GoBoardSize size
+    std::mutex query_mutex;
+    KataGoQuerySlot evaluation_slot;
+    KataGoQuerySlot move_slot;
+
+    // Speculative evaluations still running, see speculate()
+    std::vector<std::string> speculative_ids;
+    uint64_t speculation_generation = 0;
+
+    uint64_t beginQuery (KataGoQuerySlot& slot);
+    bool trackQuery (KataGoQuerySlot& slot, uint64_t generation, const std::string& id);
+    bool finishQuery (KataGoQuerySlot& slot, uint64_t generation);
+
+    std::optional<KataGoEvaluation> getStoredEvaluation (const KataGoEvaluationKey& key);
+
+    // Most queries are about the line of the previous one plus a move
+    std::mutex moves_mutex;
+    KataGoMoveList line_moves;
+
+    // The moves of line for a query, see KataGoMoveList
+    KataGoMoves getMovesText (const GoGameLine& line);
+
+    // Whole game review, filled from the engine's reader thread. The
+    // timeline holds the score lead after each move of the reviewed line.
+    std::mutex review_mutex;
+    std::vector<std::optional<double>> review_timeline;
+    KataGoReviewProgress review_progress = {0, 0};
+    std::vector<std::string> review_ids;
+
+    void cancelReview ();
+
+    // Sends one analyzeTurns query of a review
+    void reviewTurns (
+        GoGameLine line,
+        const std::vector<const GoGameNode*>& nodes,
+        const KataGoQuery& query,
+        KataGoMoves moves,
+        int turn_count
     );
 
+    // The query without its id and moves, and the cache key it maps to
+    KataGoQuery getEvaluationQueryFor (const GoGameNode* node, KataGoEvaluationKey& key);
+
+public:
+    KataGo(std::shared_ptr<KataGoService> service, GoBoardSize size);
+
     int getDiffLevel () { return diff_lvl; }
     void updateDiffLevel (int diff_lvl);
 
+    // Both take the line by shared pointer, so the caller may keep playing
+    // while the engine works. avoid_moves are illegal points for the side to
+    // move, checked against the first of the n moves.
     std::optional<std::variant<GoStone, GoTurn>> nextNMoves (
-        std::vector<GoBoardAction> actions, int n
+        GoGameLine line, int n,
+        std::vector<GoStone> avoid_moves = {}
+    );
+
+    // Served from the memory or disk cache when the position was evaluated
+    // before with the same rules, komi and visits. Otherwise on_partial, if
+    // given, gets the engine's snapshots while the search refines them.
+    std::optional<KataGoEvaluation>
+    getEvaluation (
+        GoGameLine line,
+        std::function<void(const KataGoEvaluation&)> on_partial = nullptr
     );
 
+    // Never queries the engine, safe to call from the UI thread and without
+    // an engine
     std::optional<KataGoEvaluation>
-    getEvaluation (std::vector<GoBoardAction> actions);
+    getCachedEvaluation (const GoGameNode* node);
+
+    // Analyses every position of the line with analyzeTurns queries, one
+    // per KataGo process, skipping those already cached. Returns at once, results go to the
+    // caches and the timeline as each turn comes back. False when there is
+    // no engine or a review is still running.
+    bool reviewGame (GoGameLine line);
+
+    // Queues low priority evaluations of the positions after the top
+    // candidates of evaluation, the evaluation of line, whose board is
+    // computed. Results only go to the caches, so the next move is usually
+    // answered from them. Replaces the speculation for the previous position.
+    void speculate (GoGameLine line, const GoBoardStateComputed& computed, const KataGoEvaluation& evaluation);
+    void cancelSpeculation ();
+
+    // Terminate the query for a position that is no longer on screen, the
+    // waiting caller gets std::nullopt
+    void cancelEvaluation ();
+    void cancelMoveGeneration ();
+
+    // Terminates everything asked for through this KataGo, for a board that
+    // goes away. The service keeps running.
+    void stop ();
+
+    KataGoReviewProgress getReviewProgress ();
+    std::vector<std::optional<double>> getReviewTimeline ();
 
     bool isBusy ();
-    bool isDisabled () { return is_disabled; }
+    // Also once no analysis process can be started any more
+    bool isDisabled () { return is_disabled || engine->isDown(); }
     bool isInitialized () {
         return !is_init_failure;
     }
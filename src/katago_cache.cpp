@@ -0,0 +1,68 @@
+#include "katago_cache.hpp"
+#include <functional>
+
+KataGoEvaluationKey KataGoEvaluationKey::fromQuery (
+    uint64_t position,
+    GoTurn to_move,
+    const KataGoQuery& query
+) {
+    return {
+        position,
+        to_move,
+        query.board_size,
+        query.rules,
+        query.komi,
+        query.max_visits.value_or(0)
+    };
+}
+
+size_t KataGoEvaluationKeyHash::operator() (const KataGoEvaluationKey& key) const {
+    // The Zobrist hash is already well mixed, the rest rarely changes
+    size_t hash = key.position;
+    hash ^= std::hash<std::string>()(key.rules) + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+    hash ^= std::hash<double>()(key.komi) + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+    hash ^= (size_t(key.max_visits) << 16) ^ (size_t(key.board_size) << 8)
+        ^ (key.to_move == GoTurn::WHITE ? 1 : 0);
+    return hash;
+}
+
+std::optional<KataGoEvaluation> KataGoEvaluationCache::get (const KataGoEvaluationKey& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = index.find(key);
+    if (it == index.end())
+        return std::nullopt;
+
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->second;
+}
+
+void KataGoEvaluationCache::put (const KataGoEvaluationKey& key, const KataGoEvaluation& evaluation) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = index.find(key);
+    if (it != index.end()) {
+        it->second->second = evaluation;
+        entries.splice(entries.begin(), entries, it->second);
+        return;
+    }
+
+    entries.emplace_front(key, evaluation);
+    index[key] = entries.begin();
+
+    if (entries.size() > capacity) {
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+}
+
+int KataGoEvaluationCache::getSize () {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+void KataGoEvaluationCache::clear () {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    index.clear();
+}
@@ -0,0 +1,66 @@
+#ifndef GO_KATAGO_CACHE_H
+#define GO_KATAGO_CACHE_H
+
+#include "base.hpp"
+#include "katago_engine.hpp"
+#include "katago_query.hpp"
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+// A 19x19 ownership map is ~3 KB, so this caps the cache at a few MB
+#define GO_EVALUATION_CACHE_ENTRIES 2048
+
+// Everything an evaluation depends on. The position is identified by its
+// Zobrist hash, so transpositions share an entry.
+struct KataGoEvaluationKey {
+    uint64_t position;
+    GoTurn to_move;
+    int board_size;
+    std::string rules;
+    double komi;
+    int max_visits;
+
+    // Reads the rules, komi, size and visits from the query itself, so the
+    // key always matches what is sent to the engine
+    static KataGoEvaluationKey fromQuery (uint64_t position, GoTurn to_move, const KataGoQuery& query);
+
+    bool operator== (const KataGoEvaluationKey& other) const {
+        return position == other.position
+            && to_move == other.to_move
+            && board_size == other.board_size
+            && rules == other.rules
+            && komi == other.komi
+            && max_visits == other.max_visits;
+    }
+};
+
+struct KataGoEvaluationKeyHash {
+    size_t operator() (const KataGoEvaluationKey& key) const;
+};
+
+// Least recently used evaluations, safe to share between engine threads
+class KataGoEvaluationCache {
+    typedef std::pair<KataGoEvaluationKey, KataGoEvaluation> Entry;
+
+    int capacity;
+    std::mutex mutex;
+
+    // Most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<KataGoEvaluationKey, std::list<Entry>::iterator, KataGoEvaluationKeyHash> index;
+
+public:
+    KataGoEvaluationCache (int capacity = GO_EVALUATION_CACHE_ENTRIES): capacity(capacity) {}
+
+    std::optional<KataGoEvaluation> get (const KataGoEvaluationKey& key);
+    void put (const KataGoEvaluationKey& key, const KataGoEvaluation& evaluation);
+
+    int getSize ();
+    void clear ();
+};
+
+#endif
@@ -0,0 +1,430 @@
+#include "katago_disk_cache.hpp"
+#include <SDL3/SDL_log.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef WINDOWS
+#include <sys/mman.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+static bool writeAll (int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written <= 0) return false;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+static size_t getRecordSize (const KataGoDiskRecord& record) {
+    return sizeof(KataGoDiskRecord)
+        + record.rules_length
+        + record.ownership_count
+        + record.candidate_count * sizeof(KataGoDiskCandidate);
+}
+
+KataGoDiskView::~KataGoDiskView () {
+#ifndef WINDOWS
+    if (data) munmap(const_cast<char*>(data), size);
+#endif
+}
+
+KataGoDiskCache::KataGoDiskCache (const std::string& path, size_t max_bytes):
+    path(path), max_bytes(max_bytes)
+{
+    is_failure = path.empty();
+}
+
+KataGoDiskCache::~KataGoDiskCache () {
+    if (loader.joinable())
+        loader.join();
+
+    std::lock_guard<std::mutex> lock(write_mutex);
+    close();
+}
+
+void KataGoDiskCache::load () {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    open();
+}
+
+void KataGoDiskCache::loadInBackground () {
+    loader = std::thread(&KataGoDiskCache::load, this);
+}
+
+bool KataGoDiskCache::open () {
+    if (fd >= 0 || is_failure)
+        return fd >= 0;
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_BINARY, 0644);
+    if (fd < 0) {
+        SDL_Log("[Analysis cache] Could not open %s", path.c_str());
+        is_failure = true;
+        return false;
+    }
+
+    struct stat file_stat;
+    fstat(fd, &file_stat);
+    file_size = file_stat.st_size;
+
+    KataGoDiskCacheHeader header = {0, 0};
+    if (file_size >= sizeof(header)) {
+        lseek(fd, 0, SEEK_SET);
+        if (read(fd, &header, sizeof(header)) != sizeof(header)) header = {0, 0};
+    }
+
+    // Unknown or older files are started over
+    if (header.magic != GO_DISK_CACHE_MAGIC || header.version != GO_DISK_CACHE_VERSION) {
+        header = {GO_DISK_CACHE_MAGIC, GO_DISK_CACHE_VERSION};
+        if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0
+                || !writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header))) {
+            SDL_Log("[Analysis cache] Could not write %s", path.c_str());
+            ::close(fd);
+            fd = -1;
+            is_failure = true;
+            return false;
+        }
+        file_size = sizeof(header);
+    }
+
+    std::unique_ptr<KataGoDiskView> new_view = map(fd, file_size);
+    std::unordered_map<uint64_t, uint64_t> new_index;
+    if (!new_view) {
+        SDL_Log("[Analysis cache] Could not map %s", path.c_str());
+        ::close(fd);
+        fd = -1;
+        is_failure = true;
+        return false;
+    }
+
+    // A record cut short by a crash, appends continue from the last good one
+    size_t end = buildIndex(*new_view, new_index);
+    if (end != file_size) {
+        SDL_Log("[Analysis cache] Dropping %zu bytes of a partial record", file_size - end);
+        if (ftruncate(fd, end) == 0) {
+            file_size = end;
+        }
+        new_view = map(fd, file_size);
+        new_index.clear();
+        if (!new_view) {
+            SDL_Log("[Analysis cache] Could not map %s", path.c_str());
+            ::close(fd);
+            fd = -1;
+            is_failure = true;
+            return false;
+        }
+        buildIndex(*new_view, new_index);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    view.swap(new_view);
+    index.swap(new_index);
+    tail.clear();
+    is_opened = true;
+    return true;
+}
+
+void KataGoDiskCache::close () {
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    file_size = 0;
+
+    std::unique_ptr<KataGoDiskView> old_view;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        old_view.swap(view);
+        index.clear();
+        tail.clear();
+        is_opened = false;
+    }
+}
+
+std::unique_ptr<KataGoDiskView> KataGoDiskCache::map (int fd, size_t size) {
+    auto view = std::make_unique<KataGoDiskView>();
+    if (size == 0)
+        return view;
+
+#ifndef WINDOWS
+    void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+        return nullptr;
+    view->data = static_cast<const char*>(data);
+#else
+    // Windows reads the file instead of mapping it
+    view->buffer.resize(size);
+    lseek(fd, 0, SEEK_SET);
+    for (size_t done = 0; done < size;) {
+        int count = read(fd, view->buffer.data() + done, size - done);
+        if (count <= 0) return nullptr;
+        done += count;
+    }
+    view->data = view->buffer.data();
+#endif
+
+    view->size = size;
+    return view;
+}
+
+size_t KataGoDiskCache::buildIndex (const KataGoDiskView& view, std::unordered_map<uint64_t, uint64_t>& index) {
+    // Only the fixed part and the key of each record are read
+    size_t offset = sizeof(KataGoDiskCacheHeader);
+    while (offset + sizeof(KataGoDiskRecord) <= view.size) {
+        KataGoDiskRecord record;
+        std::memcpy(&record, view.data + offset, sizeof(record));
+        if (record.length < getRecordSize(record) || offset + record.length > view.size)
+            break;
+
+        index[KataGoEvaluationKeyHash()(decodeKey(view.data + offset))] = offset;
+        offset += record.length;
+    }
+    return offset;
+}
+
+const char* KataGoDiskCache::getRecord (uint64_t offset) const {
+    // Every open file has a view, see open()
+    return offset < view->size ?
+        view->data + offset :
+        tail.data() + (offset - view->size);
+}
+
+std::string KataGoDiskCache::encode (const KataGoEvaluationKey& key, const KataGoEvaluation& evaluation) {
+    int board_size = evaluation.ownership.size();
+
+    KataGoDiskRecord record = {};
+    record.max_visits = key.max_visits;
+    record.position = key.position;
+    record.komi = key.komi;
+    record.score = evaluation.score;
+    record.to_move = key.to_move == GoTurn::BLACK ? 0 : 1;
+    record.board_size = key.board_size;
+    record.rules_length = std::min<size_t>(key.rules.size(), 255);
+    record.candidate_count = std::min<size_t>(evaluation.candidates.size(), GO_DISK_CACHE_CANDIDATES);
+    record.ownership_count = board_size * board_size;
+    record.length = getRecordSize(record);
+
+    std::string bytes(record.length, '\0');
+    char* out = bytes.data();
+    std::memcpy(out, &record, sizeof(record));
+    out += sizeof(record);
+
+    std::memcpy(out, key.rules.data(), record.rules_length);
+    out += record.rules_length;
+
+    for (int x = 0; x < board_size; x++) {
+        for (int y = 0; y < board_size; y++) {
+            double value = std::clamp(evaluation.ownership[x][y], -1.0, 1.0);
+            *out++ = static_cast<int8_t>(std::lround(value * 127));
+        }
+    }
+
+    for (int i = 0; i < record.candidate_count; i++) {
+        const KataGoCandidate& candidate = evaluation.candidates[i];
+
+        KataGoDiskCandidate stored = {};
+        std::memcpy(stored.move, candidate.move.data(), std::min<size_t>(candidate.move.size(), sizeof(stored.move)));
+        stored.visits = candidate.visits;
+        stored.winrate = candidate.winrate;
+        stored.score_lead = candidate.score_lead;
+
+        std::memcpy(out, &stored, sizeof(stored));
+        out += sizeof(stored);
+    }
+
+    return bytes;
+}
+
+KataGoEvaluationKey KataGoDiskCache::decodeKey (const char* data) {
+    KataGoDiskRecord record;
+    std::memcpy(&record, data, sizeof(record));
+
+    return {
+        record.position,
+        record.to_move == 0 ? GoTurn::BLACK : GoTurn::WHITE,
+        record.board_size,
+        std::string(data + sizeof(record), record.rules_length),
+        record.komi,
+        static_cast<int>(record.max_visits)
+    };
+}
+
+KataGoEvaluation KataGoDiskCache::decode (const char* data) {
+    KataGoDiskRecord record;
+    std::memcpy(&record, data, sizeof(record));
+    const char* in = data + sizeof(record) + record.rules_length;
+
+    int board_size = std::sqrt(record.ownership_count);
+    KataGoEvaluation evaluation = {
+        record.score,
+        std::vector<std::vector<double>>(board_size, std::vector<double>(board_size, 0))
+    };
+
+    for (int x = 0; x < board_size; x++) {
+        for (int y = 0; y < board_size; y++) {
+            evaluation.ownership[x][y] = static_cast<int8_t>(*in++) / 127.0;
+        }
+    }
+
+    for (int i = 0; i < record.candidate_count; i++) {
+        KataGoDiskCandidate stored;
+        std::memcpy(&stored, in, sizeof(stored));
+        in += sizeof(stored);
+
+        evaluation.candidates.push_back({
+            std::string(stored.move, strnlen(stored.move, sizeof(stored.move))),
+            static_cast<int>(stored.visits),
+            stored.winrate,
+            stored.score_lead
+        });
+    }
+
+    return evaluation;
+}
+
+std::optional<KataGoEvaluation> KataGoDiskCache::get (const KataGoEvaluationKey& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Still loading, or no file
+    if (!is_opened)
+        return std::nullopt;
+
+    auto it = index.find(KataGoEvaluationKeyHash()(key));
+    if (it == index.end())
+        return std::nullopt;
+
+    // Different keys may share a digest
+    const char* record = getRecord(it->second);
+    if (!(decodeKey(record) == key))
+        return std::nullopt;
+
+    return decode(record);
+}
+
+void KataGoDiskCache::put (const KataGoEvaluationKey& key, const KataGoEvaluation& evaluation) {
+    std::lock_guard<std::mutex> write_lock(write_mutex);
+    if (!open())
+        return;
+
+    std::string bytes = encode(key, evaluation);
+    if (lseek(fd, file_size, SEEK_SET) < 0 || !writeAll(fd, bytes.data(), bytes.size())) {
+        SDL_Log("[Analysis cache] Write failed, disabling the cache");
+        close();
+        is_failure = true;
+        return;
+    }
+
+    uint64_t offset = file_size;
+    file_size += bytes.size();
+
+    // Lookups see the record from the tail until the file is mapped again.
+    // Indexed before compacting too, which only keeps indexed records.
+    bool is_tail_full;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tail += bytes;
+        index[KataGoEvaluationKeyHash()(key)] = offset;
+        is_tail_full = tail.size() >= GO_DISK_CACHE_TAIL_BYTES;
+    }
+
+    if (file_size > max_bytes) {
+        compact();
+    } else if (is_tail_full) {
+        std::unique_ptr<KataGoDiskView> new_view = map(fd, file_size);
+        if (new_view) {
+            std::lock_guard<std::mutex> lock(mutex);
+            view.swap(new_view);
+            tail.clear();
+        }
+    }
+}
+
+void KataGoDiskCache::compact () {
+    // The view and the tail only change under write_mutex, which is held,
+    // so they are read here without blocking lookups
+    std::vector<uint64_t> offsets;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        offsets.reserve(index.size());
+        for (const auto& [digest, offset] : index) {
+            offsets.push_back(offset);
+        }
+    }
+    std::sort(offsets.begin(), offsets.end());
+
+    // Newest records first until half the budget is used, so the next
+    // compaction is as far away as this one was
+    size_t kept_size = sizeof(KataGoDiskCacheHeader);
+    size_t first_kept = offsets.size();
+    while (first_kept > 0) {
+        KataGoDiskRecord record;
+        std::memcpy(&record, getRecord(offsets[first_kept - 1]), sizeof(record));
+        if (kept_size + record.length > max_bytes / 2) break;
+
+        kept_size += record.length;
+        first_kept--;
+    }
+
+    std::string temp_path = path + ".tmp";
+    int temp_fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (temp_fd < 0) {
+        SDL_Log("[Analysis cache] Could not compact %s", path.c_str());
+        return;
+    }
+
+    KataGoDiskCacheHeader header = {GO_DISK_CACHE_MAGIC, GO_DISK_CACHE_VERSION};
+    std::string bytes(reinterpret_cast<const char*>(&header), sizeof(header));
+    bytes.reserve(kept_size);
+    for (size_t i = first_kept; i < offsets.size(); i++) {
+        const char* data = getRecord(offsets[i]);
+        KataGoDiskRecord record;
+        std::memcpy(&record, data, sizeof(record));
+        bytes.append(data, record.length);
+    }
+
+    bool is_written = writeAll(temp_fd, bytes.data(), bytes.size());
+    ::close(temp_fd);
+    if (!is_written) {
+        std::remove(temp_path.c_str());
+        return;
+    }
+
+    // Lookups keep reading the old view until the new one is swapped in
+    ::close(fd);
+    fd = -1;
+#ifdef WINDOWS
+    // rename does not replace an existing file here
+    std::remove(path.c_str());
+#endif
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        // Opening the old file again would compact on every put
+        SDL_Log("[Analysis cache] Could not replace %s, disabling the cache", path.c_str());
+        std::remove(temp_path.c_str());
+        close();
+        is_failure = true;
+        return;
+    }
+    open();
+}
+
+int KataGoDiskCache::getEntryCount () {
+    std::lock_guard<std::mutex> write_lock(write_mutex);
+    open();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return index.size();
+}
+
+size_t KataGoDiskCache::getFileSize () {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    open();
+    return file_size;
+}
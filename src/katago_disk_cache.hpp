@@ -0,0 +1,137 @@
+#ifndef GO_KATAGO_DISK_CACHE_H
+#define GO_KATAGO_DISK_CACHE_H
+
+#include "katago_cache.hpp"
+#include "katago_engine.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define GO_DISK_CACHE_MAGIC 0x43414F47 // "GOAC"
+#define GO_DISK_CACHE_VERSION 1
+
+// Candidate moves kept per record, best first
+#define GO_DISK_CACHE_CANDIDATES 8
+
+// Records appended since the file was mapped are kept in memory up to this
+// size, then the file is mapped again
+#define GO_DISK_CACHE_TAIL_BYTES (1 << 20)
+
+struct KataGoDiskCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+};
+
+// Fixed part of a record. It is followed by the rules string, one byte of
+// ownership per point (scaled to -127..127) and the candidate moves.
+struct KataGoDiskRecord {
+    uint32_t length; // of the whole record
+    uint32_t max_visits;
+    uint64_t position;
+    double komi;
+    double score;
+    uint8_t to_move;
+    uint8_t board_size;
+    uint8_t rules_length;
+    uint8_t candidate_count;
+    uint16_t ownership_count;
+    uint16_t reserved;
+};
+
+struct KataGoDiskCandidate {
+    char move[4]; // "Q16", "pass", not null terminated when full
+    uint32_t visits;
+    float winrate;
+    float score_lead;
+};
+
+// Read only view of the first size bytes of the file, mapped or, on
+// Windows, read into memory
+struct KataGoDiskView {
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef WINDOWS
+    std::vector<char> buffer;
+#endif
+
+    KataGoDiskView () = default;
+    ~KataGoDiskView ();
+
+    KataGoDiskView(const KataGoDiskView&) = delete;
+    KataGoDiskView& operator=(const KataGoDiskView&) = delete;
+};
+
+// Evaluations kept across sessions in one append-only file. Records are
+// never rewritten in place, a newer record for the same key shadows the
+// older one. Only the index (key digest to offset) lives in memory, the
+// records are read from the mapped file when looked up. Once the file grows
+// past max_bytes it is compacted to the newest half of the live records.
+//
+// Lookups come from the UI thread, so they never wait on the file: opening,
+// indexing, appending and compacting are done under write_mutex, and only
+// swapping their results in takes the lookup mutex.
+class KataGoDiskCache {
+    std::string path;
+    size_t max_bytes;
+
+    // Held while the file is read or written
+    std::mutex write_mutex;
+    bool is_failure = false;
+    int fd = -1;
+    size_t file_size = 0;
+
+    // Held by lookups, and by writers only to swap in what they built
+    std::mutex mutex;
+    bool is_opened = false;
+    std::unique_ptr<KataGoDiskView> view;
+
+    // Bytes of the file after the view, the records appended since
+    std::string tail;
+
+    std::unordered_map<uint64_t, uint64_t> index;
+
+    std::thread loader;
+
+    bool open ();
+    void close ();
+    void compact ();
+
+    // Record at offset in the view or the tail, under either mutex
+    const char* getRecord (uint64_t offset) const;
+
+    static std::unique_ptr<KataGoDiskView> map (int fd, size_t size);
+
+    // Adds the complete records of view to index. Returns where the first
+    // partial one starts.
+    static size_t buildIndex (const KataGoDiskView& view, std::unordered_map<uint64_t, uint64_t>& index);
+
+    static std::string encode (const KataGoEvaluationKey& key, const KataGoEvaluation& evaluation);
+    static KataGoEvaluationKey decodeKey (const char* record);
+    static KataGoEvaluation decode (const char* record);
+
+public:
+    // An empty path disables the cache
+    KataGoDiskCache (const std::string& path, size_t max_bytes);
+    ~KataGoDiskCache ();
+
+    // Opens and indexes the file, lookups miss until it is done
+    void load ();
+    void loadInBackground ();
+
+    std::optional<KataGoEvaluation> get (const KataGoEvaluationKey& key);
+    void put (const KataGoEvaluationKey& key, const KataGoEvaluation& evaluation);
+
+    int getEntryCount ();
+    size_t getFileSize ();
+
+    KataGoDiskCache(const KataGoDiskCache&) = delete;
+    KataGoDiskCache& operator=(const KataGoDiskCache&) = delete;
+};
+
+#endif
@@ -1,8 +1,12 @@
 #include "katago_engine.hpp"
 #include "error.hpp"
+#include "katago_framer.hpp"
+#include "katago_query.hpp"
 #include <iostream>
 #include <SDL3/SDL_log.h>
+#include <algorithm>
 #include <filesystem>
+#include <cerrno>
 #include <cmath>
 #include <optional>
 
@@ -10,7 +14,7 @@ using json = nlohmann::json;
 
 bool doesKataGoExist (std::string katago_path) {
 #ifndef WINDOWS
-    std::string cmd = "command -v " + katago_path + " /dev/null 2>&1";
+    std::string cmd = "command -v " + katago_path + " >/dev/null 2>&1";
 #else
     std::string cmd = katago_path;
 #endif
@@ -23,48 +27,86 @@ static void setNonBlocking(int fd) {
     int flags = fcntl(fd, F_GETFL, 0);
     fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
+
+// Keeps our ends of the pipes out of the other processes of a pool
+static void setCloseOnExec(int fd) {
+    int flags = fcntl(fd, F_GETFD, 0);
+    fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+}
 #endif
 
 KataGoEngine::KataGoEngine(
     const std::string& katagoPath,
     const std::string& configPath,
     const std::string& modelPath,
-    std::function<void(bool)> init_callback
+    std::function<void()> exit_callback
+):
+    exit_callback(exit_callback)
+{
+#ifndef WINDOWS
+    // A process that died must not take us down on the next write
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    startProcess(katagoPath, configPath, modelPath);
+    if (is_init_failure)
+        return;
+
+    readerThread = std::thread(&KataGoEngine::readerLoop, this);
+}
+
+bool KataGoEngine::isStartable(
+    const std::string& katagoPath,
+    const std::string& configPath,
+    const std::string& modelPath
 ) {
     if (!doesKataGoExist(katagoPath)) {
-        is_init_failure = true;
-        init_callback(is_init_failure);
         SDL_Log("Failed because katago doesnt exist");
-        return;
+        return false;
     }
 
     if (!std::filesystem::exists(configPath)
             || !std::filesystem::exists(modelPath)
     ) {
-        is_init_failure = true;
-        init_callback(is_init_failure);
         SDL_Log("Failed because katago config or model doesnt exit");
-        return;
+        return false;
     }
 
-    startProcess(katagoPath, configPath, modelPath);
-    readerThread = std::thread(&KataGoEngine::readerLoop, this);
+    return true;
 }
 
 KataGoEngine::~KataGoEngine() {
     running = false;
 
+#ifndef WINDOWS
+    if (wakeWriteFd >= 0) {
+        char wake = 0;
+        write(wakeWriteFd, &wake, 1);
+    } else if (childPid > 0) {
+        // Without the self-pipe the reader wakes up to the end of the output
+        kill(childPid, SIGTERM);
+    }
+
     if(readerThread.joinable())
         readerThread.join();
 
-#ifndef WINDOWS
     if(childPid > 0) {
         kill(childPid, SIGTERM);
         waitpid(childPid, nullptr, 0);
     }
+
+    for (int fd : {inWriteFd, outReadFd, wakeReadFd, wakeWriteFd}) {
+        if (fd >= 0) close(fd);
+    }
 #else
     if (pi.hProcess) {
         TerminateProcess(pi.hProcess, 0);
+    }
+
+    if(readerThread.joinable())
+        readerThread.join();
+
+    if (pi.hProcess) {
         CloseHandle(pi.hProcess);
         CloseHandle(pi.hThread);
     }
@@ -81,10 +123,28 @@ void KataGoEngine::startProcess(
 ) {
 #ifndef WINDOWS
     int toChild[2], fromChild[2];
-    pipe(toChild);
-    pipe(fromChild);
+    if (pipe(toChild) != 0) {
+        is_init_failure = true;
+        return;
+    }
+    if (pipe(fromChild) != 0) {
+        close(toChild[0]);
+        close(toChild[1]);
+        is_init_failure = true;
+        return;
+    }
 
     childPid = fork();
+    if (childPid < 0) {
+        SDL_Log("fork failed");
+        for (int fd : {toChild[0], toChild[1], fromChild[0], fromChild[1]}) {
+            close(fd);
+        }
+        childPid = -1;
+        is_init_failure = true;
+        return;
+    }
+
     if(childPid == 0) {
         // CHILD
         dup2(toChild[0], STDIN_FILENO);
@@ -111,6 +171,16 @@ void KataGoEngine::startProcess(
     close(fromChild[1]);
 
     setNonBlocking(outReadFd);
+    setCloseOnExec(inWriteFd);
+    setCloseOnExec(outReadFd);
+
+    int wake[2];
+    if (pipe(wake) == 0) {
+        wakeReadFd = wake[0];
+        wakeWriteFd = wake[1];
+        setCloseOnExec(wakeReadFd);
+        setCloseOnExec(wakeWriteFd);
+    }
 #else
     SECURITY_ATTRIBUTES sa{};
     sa.nLength = sizeof(SECURITY_ATTRIBUTES);
@@ -154,7 +224,10 @@ void KataGoEngine::startProcess(
 
     if (!ok) {
         SDL_Log("CreateProcess failed");
-        exit(1);
+        CloseHandle(hChildStdoutWr);
+        CloseHandle(hChildStdinRd);
+        is_init_failure = true;
+        return;
     }
 
     SDL_Log("[Katago started successfully]");
@@ -170,154 +243,290 @@ void KataGoEngine::startProcess(
 }
 
 void KataGoEngine::readerLoop() {
-    char buffer[8192];
-    std::string current;
+    KataGoLineFramer framer;
 
 #ifndef WINDOWS
+    pollfd fds[2] = {
+        {outReadFd, POLLIN, 0},
+        {wakeReadFd, POLLIN, 0}
+    };
+
     while(running) {
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(outReadFd, &readfds);
+        // Sleeps until KataGo writes or the destructor wakes us up
+        int ret = poll(fds, 2, -1);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            onExit();
+            return;
+        }
 
-        timeval tv{0, 200};
+        if (fds[1].revents)
+            return;
 
-        int ret = select(outReadFd + 1, &readfds, nullptr, nullptr, &tv);
-        if(ret > 0 && FD_ISSET(outReadFd, &readfds)) {
-            ssize_t n = read(outReadFd, buffer, sizeof(buffer));
+        if (fds[0].revents) {
+            auto [data, size] = framer.prepare();
+            ssize_t n = read(outReadFd, data, size);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+                if (running) onExit();
+                return;
+            }
             if(n > 0) {
-                current.append(buffer, n);
-                size_t pos;
-                while((pos = current.find('\n')) != std::string::npos) {
-                    std::string line = current.substr(0, pos);
-                    current.erase(0, pos + 1);
-
-                    try {
-                        json j = json::parse(line);
-                        {
-                            std::lock_guard<std::mutex> lk(qMutex);
-                            messageQueue.push(j);
-                        }
-                        qCv.notify_one();
-                    }
-                    catch(...) {
-                        // skip bad json
-                    }
-                }
+                framer.commit(n);
+                framer.forEachLine([&](std::string_view line) {
+                    dispatchLine(line);
+                });
             }
         }
     }
 #else
     bool is_ready = false;
     while (running) {
-        DWORD available = 0;
-        if (!PeekNamedPipe(hChildStdoutRd, NULL, 0, NULL, &available, NULL)) {
-            Sleep(1);
-            continue;
-        }
-        if (available == 0) {
-            Sleep(1);
-            continue;
-        }
-
+        // Blocks until KataGo writes. The destructor ends the process first,
+        // which breaks the pipe and returns here.
+        auto [data, size] = framer.prepare();
         DWORD bytesRead = 0;
-        if (!ReadFile(hChildStdoutRd, buffer, sizeof(buffer), &bytesRead, NULL)) {
-            Sleep(1);
+        if (!ReadFile(hChildStdoutRd, data, size, &bytesRead, NULL)) {
+            if (GetLastError() == ERROR_BROKEN_PIPE) {
+                if (running) onExit();
+                return;
+            }
             continue;
         }
 
-        current.append(buffer, bytesRead);
-
-        size_t pos;
-        while ((pos = current.find('\n')) != std::string::npos) {
-            std::string line = current.substr(0, pos);
-            current.erase(0, pos + 1);
-
+        framer.commit(bytesRead);
+        framer.forEachLine([&](std::string_view line) {
             if (!is_ready) {
-                if (line.find("Started, ready to begin handling requests") != std::string::npos) {
+                if (line.find("Started, ready to begin handling requests") != std::string_view::npos) {
                     is_ready = true;
                 }
-                continue;
+                return;
             }
 
-            try {
-                json j = json::parse(line);
-                {
-                    std::lock_guard<std::mutex> lk(qMutex);
-                    messageQueue.push(j);
-                }
-                qCv.notify_one();
-            } catch (...) {
-                // ignore invalid JSON
-                SDL_Log("[JSON parse error]");
-            }
+            dispatchLine(line);
+        });
+    }
+#endif
+}
+
+void KataGoEngine::onExit() {
+#ifndef WINDOWS
+    // Reaped here rather than in the destructor, so the status makes it to
+    // the log and a pool restarting it leaves no zombie behind
+    pid_t pid = childPid.exchange(-1);
+    if (pid > 0) {
+        int status = 0;
+        pid_t reaped = 0;
+        for (int i = 0; i < 100 && reaped == 0; i++) {
+            reaped = waitpid(pid, &status, WNOHANG);
+            if (reaped == 0) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        // Closed its output without exiting, it would never answer again
+        if (reaped == 0) {
+            kill(pid, SIGKILL);
+            reaped = waitpid(pid, &status, 0);
+        }
+
+        if (reaped > 0 && WIFSIGNALED(status)) {
+            SDL_Log("[KataGo exited] Killed by signal %d", WTERMSIG(status));
+        } else if (reaped > 0) {
+            SDL_Log("[KataGo exited] Exit status %d", WEXITSTATUS(status));
         }
     }
 #endif
+
+    SDL_Log("[KataGo exited] %d queries lost", dispatcher.getPendingCount());
+    dispatcher.failAll();
+    is_exited = true;
+
+    if (exit_callback) {
+        exit_callback();
+    }
+}
+
+void KataGoEngine::forceExit() {
+    if (is_init_failure)
+        return;
+
+#ifndef WINDOWS
+    pid_t pid = childPid;
+    if (pid > 0) {
+        kill(pid, SIGKILL);
+    }
+#else
+    if (pi.hProcess) {
+        TerminateProcess(pi.hProcess, 1);
+    }
+#endif
 }
 
 void KataGoEngine::sendJSON(const json& j) {
     if (is_init_failure)
         return;
 
-    std::string s = j.dump() + "\n";
+    std::lock_guard<std::mutex> lock(write_mutex);
+    write_buffer.clear();
+    write_buffer += j.dump();
+    write_buffer += '\n';
+    writeBuffer();
+}
+
+void KataGoEngine::sendQuery(const KataGoQuery& query, std::string_view moves) {
+    if (is_init_failure)
+        return;
+
+    std::lock_guard<std::mutex> lock(write_mutex);
+    writeKataGoQuery(write_buffer, query, moves);
+    writeBuffer();
+}
+
+void KataGoEngine::writeBuffer() {
 #ifndef WINDOWS
-    write(inWriteFd, s.c_str(), s.size());
+    write(inWriteFd, write_buffer.data(), write_buffer.size());
 #else
     DWORD written = 0;
-    WriteFile(hChildStdinWr, s.c_str(), s.size(), &written, NULL);
+    WriteFile(hChildStdinWr, write_buffer.data(), write_buffer.size(), &written, NULL);
 #endif
 }
 
-json KataGoEngine::getJSON() {
-    std::unique_lock<std::mutex> lk(qMutex);
-    qCv.wait(lk, [&]{ return !messageQueue.empty(); });
-    json j = messageQueue.front();
-    messageQueue.pop();
-    return j;
+bool KataGoDispatcher::expect (const std::string& id, KataGoResponseHandler handler) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (cancelled.erase(id))
+        return false;
+
+    pending[id] = std::make_shared<KataGoResponseHandler>(std::move(handler));
+    return true;
 }
 
-std::optional<std::vector<std::string>>
-KataGoEngine::getNextMove(int topN) {
+void KataGoDispatcher::cancel (const std::string& id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.erase(id);
+    if (!cancelled.insert(id).second)
+        return;
+
+    cancelled_order.push_back(id);
+    if (cancelled_order.size() > KATAGO_CANCELLED_IDS_KEPT) {
+        cancelled.erase(cancelled_order.front());
+        cancelled_order.pop_front();
+    }
+}
+
+bool KataGoDispatcher::dispatch (const KataGoResponse& response) {
+    if (response.id.empty())
+        return false;
+
+    const std::string& id = response.id;
+    std::shared_ptr<KataGoResponseHandler> handler;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = pending.find(id);
+        if (it == pending.end()) {
+            // KataGo still answers a terminated query, once per turn
+            return cancelled.count(id) > 0;
+        }
+        handler = it->second;
+    }
+
+    // Warnings are about one field of a query that still gets answered
+    if (!response.warning.empty() && response.error.empty()) {
+        SDL_Log("[KataGo warning] %s: %s", id.c_str(), response.warning.c_str());
+        return true;
+    }
+
+    // Outside the lock, so a handler may send a follow up query
+    if ((*handler)(response)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.erase(id);
+    }
+    return true;
+}
+
+void KataGoDispatcher::failAll () {
+    std::unordered_map<std::string, std::shared_ptr<KataGoResponseHandler>> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        dropped.swap(pending);
+        cancelled.clear();
+        cancelled_order.clear();
+    }
+    // Destroyed outside the lock, a handler may own a promise whose future
+    // is waited on
+}
+
+int KataGoDispatcher::getPendingCount () {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending.size();
+}
+
+void KataGoEngine::dispatchLine(std::string_view line) {
+    if (!KataGoResponseDecoder::decode(line, response)) {
+        // skip bad json
+        SDL_Log("[JSON parse error]");
+        return;
+    }
+
+    if (!dispatcher.dispatch(response)) {
+        SDL_Log("[KataGo response without a query] %.*s", static_cast<int>(line.size()), line.data());
+    }
+}
+
+void KataGoEngine::query(const KataGoQuery& query, std::string_view moves, KataGoResponseHandler handler) {
     if (is_init_failure)
-        return std::nullopt;
+        return;
 
-    json msg = getJSON();
+    // Registered first, the response may arrive before sendQuery returns
+    if (dispatcher.expect(query.id, std::move(handler))) {
+        sendQuery(query, moves);
+    }
+}
 
-    if (!msg.contains("moveInfos") || msg["moveInfos"].empty()
-            || !msg.contains("rootInfo") || !msg["rootInfo"].contains("currentPlayer")
-    ) {
+void KataGoEngine::cancel(const std::string& id) {
+    if (is_init_failure)
+        return;
+
+    dispatcher.cancel(id);
+
+    // Never one of our query ids, which may come from a pool of engines
+    json terminate;
+    terminate["id"] = "terminate:" + id;
+    terminate["action"] = "terminate";
+    terminate["terminateId"] = id;
+
+    // The acknowledgement is of no interest
+    dispatcher.cancel(terminate["id"]);
+    sendJSON(terminate);
+}
+
+std::optional<std::vector<std::string>>
+KataGoEngine::parseNextMove(const KataGoResponse& msg) {
+    if (msg.move_infos.empty() || msg.current_player.empty()) {
         GoErrorHandler::throwError(GoErrorEnum::ENGINE_NOT_USABLE);
         return std::nullopt;
     }
 
     std::vector<std::string> move(2);
-    move[0] = msg["rootInfo"]["currentPlayer"];
-    move[1] = msg["moveInfos"][0]["move"];
+    move[0] = msg.current_player;
+    move[1] = msg.move_infos[0].move;
 
     return std::make_optional<std::vector<std::string>>(move);
 }
 
-std::optional<KataGoEvaluation>
-KataGoEngine::getEvaluation () {
-    if (is_init_failure)
-        return std::nullopt;
-
-    json msg = getJSON();
+bool KataGoEngine::isEvaluation (const KataGoResponse& msg) {
+    return msg.has_ownership && msg.has_score_lead;
+}
 
-    if (!msg.contains("ownership") || !msg.contains("rootInfo") || !msg["rootInfo"].contains("scoreLead")) {
+std::optional<KataGoEvaluation>
+KataGoEngine::parseEvaluation (const KataGoResponse& msg) {
+    if (!isEvaluation(msg)) {
         GoErrorHandler::throwError(GoErrorEnum::ENGINE_NOT_USABLE);
         return std::nullopt;
     }
 
-    int board_size = std::sqrt(msg["ownership"].size());
+    int board_size = std::sqrt(msg.ownership.size());
     std::vector<std::vector<double>> ownership(board_size, std::vector<double>(board_size, 0));
-    for (int i = 0; i < msg["ownership"].size(); i++) {
-        int x = i/board_size;
-        int y = i%board_size;
-        ownership[x][y] = msg["ownership"][i];
+    for (int x = 0; x < board_size; x++) {
+        std::copy_n(msg.ownership.begin() + x * board_size, board_size, ownership[x].begin());
     }
 
-    KataGoEvaluation eval;
-
-    return std::make_optional<KataGoEvaluation>({msg["rootInfo"]["scoreLead"], ownership});
+    return std::make_optional<KataGoEvaluation>({msg.score_lead, ownership, msg.move_infos});
 }
@@ -4,19 +4,25 @@
 #define _DARWIN_C_SOURCE
 #include <signal.h>
 
+#include <deque>
 #include <functional>
+#include <future>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <atomic>
-#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
 #include <unistd.h>
 #include <fcntl.h>
 #include "json.hpp"
+#include "katago_query.hpp"
+#include "katago_response.hpp"
 
 #ifndef WINDOWS
-#include <sys/select.h>
+#include <poll.h>
 #include <sys/wait.h>
 #else
 #include <windows.h>
@@ -25,6 +31,43 @@
 struct KataGoEvaluation {
     double score;
     std::vector<std::vector<double>> ownership;
+    std::vector<KataGoCandidate> candidates = {};
+};
+
+#define KATAGO_CANCELLED_IDS_KEPT 256
+
+// Called with every response to a query, returns true once the query is done.
+// The response is reused for the next line, handlers copy what they keep.
+typedef std::function<bool(const KataGoResponse&)> KataGoResponseHandler;
+
+// Routes each response line to the query that asked for it by "id", so any
+// number of queries can be in flight at once
+class KataGoDispatcher {
+    std::mutex mutex;
+    // Shared so that the copy called outside the lock keeps the state of
+    // handlers counting their responses
+    std::unordered_map<std::string, std::shared_ptr<KataGoResponseHandler>> pending;
+
+    // Ids cancelled before their final response, whatever still arrives
+    // for them is dropped. An analyzeTurns query may have many responses on
+    // their way, so ids are only forgotten once KATAGO_CANCELLED_IDS_KEPT
+    // newer ones were cancelled.
+    std::unordered_set<std::string> cancelled;
+    std::deque<std::string> cancelled_order;
+
+public:
+    // False when the id was cancelled before it was sent
+    bool expect (const std::string& id, KataGoResponseHandler handler);
+    void cancel (const std::string& id);
+
+    // Returns false when no query is waiting for the id of the response
+    bool dispatch (const KataGoResponse& response);
+
+    // Drops every waiting handler, for a process that exited. Their waiting
+    // futures fail.
+    void failAll ();
+
+    int getPendingCount ();
 };
 
 class KataGoEngine {
@@ -33,7 +76,12 @@ private:
 #ifndef WINDOWS
     int inWriteFd = -1;
     int outReadFd = -1;
-    pid_t childPid = -1;
+    // Reset once the reader reaped the process
+    std::atomic<pid_t> childPid{-1};
+
+    // Self-pipe, the destructor writes a byte to wake the reader up
+    int wakeReadFd = -1;
+    int wakeWriteFd = -1;
 #else
     HANDLE hChildStdinWr = NULL;
     HANDLE hChildStdoutRd = NULL;
@@ -43,37 +91,84 @@ private:
     bool is_init_failure = false;
     std::thread readerThread;
     std::atomic<bool> running{true};
+    std::atomic<bool> is_exited{false};
+    std::function<void()> exit_callback;
+
+    KataGoDispatcher dispatcher;
+
+    // Every line is decoded into this one on the reader thread
+    KataGoResponse response;
+
+    // Queries are written out here, one at a time, so that long ones from
+    // different threads do not interleave in the pipe
+    std::mutex write_mutex;
+    std::string write_buffer;
 
-    std::mutex qMutex;
-    std::condition_variable qCv;
-    std::queue<nlohmann::json> messageQueue;
+    void sendQuery(const KataGoQuery& query, std::string_view moves);
+    void writeBuffer();
 
     void readerLoop();
+    void dispatchLine(std::string_view line);
+    void onExit();
     void startProcess(
         const std::string& katagoPath,
         const std::string& configPath,
         const std::string& modelPath
     );
 
-    nlohmann::json getJSON();
-
 public:
+    // Starts the process at once, see isStartable() for the paths
     KataGoEngine(
         const std::string& katagoPath,
         const std::string& configPath,
         const std::string& modelPath,
-        std::function<void(bool)> init_callback
+        std::function<void()> exit_callback = nullptr
     );
 
     ~KataGoEngine();
 
+    // Whether KataGo, its config and its model are where they are said to
+    // be. Shells out, so it is checked once rather than on every start.
+    static bool isStartable(
+        const std::string& katagoPath,
+        const std::string& configPath,
+        const std::string& modelPath
+    );
+
     void sendJSON(const nlohmann::json& j);
 
-    std::optional<std::vector<std::string>>
-        getNextMove (int topN = 1);
+    // Sends a query and hands its responses to handler from the reader
+    // thread. The handler must not block. Nothing is sent when the id was
+    // already cancelled. moves is the inside of the "moves" array, see
+    // KataGoMoveList.
+    void query(const KataGoQuery& query, std::string_view moves, KataGoResponseHandler handler);
+
+    // Asks KataGo to stop the query with a terminate action. Its handler is
+    // dropped at once, so a waiting future fails and late responses are
+    // discarded.
+    void cancel(const std::string& id);
+
+    // Set once the process is gone, every query it had was failed. The
+    // exit callback runs right after, on the reader thread.
+    bool hasExited() const { return is_exited; }
+
+    // Kills a process that stopped answering, the reader then goes through
+    // the same exit as for a crash
+    void forceExit();
+
+    // The process could not be started, nothing is sent
+    bool isInitFailure() const { return is_init_failure; }
+
+    // Queries sent and not answered yet
+    int getLoad() { return dispatcher.getPendingCount(); }
+
+    static std::optional<std::vector<std::string>>
+        parseNextMove (const KataGoResponse& msg);
+
+    static bool isEvaluation (const KataGoResponse& msg);
 
-    std::optional<KataGoEvaluation>
-        getEvaluation ();
+    static std::optional<KataGoEvaluation>
+        parseEvaluation (const KataGoResponse& msg);
 };
 
 #endif
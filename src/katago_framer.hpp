@@ -0,0 +1,77 @@
+#ifndef GO_KATAGO_FRAMER_H
+#define GO_KATAGO_FRAMER_H
+
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#define KATAGO_FRAMER_CAPACITY (64 * 1024)
+
+// Reads are never smaller than this, the buffer is compacted or grown first
+#define KATAGO_FRAMER_MIN_READ (8 * 1024)
+
+// Splits KataGo's output into lines without copying them. Reads go straight
+// into the buffer and every complete line is handed out as a view of it,
+// valid until the next prepare(). The unfinished tail is moved to the front
+// at most once per read, so framing stays linear however many lines a read
+// brings.
+class KataGoLineFramer {
+    std::vector<char> buffer;
+    size_t begin = 0;   // first byte not handed out yet
+    size_t end = 0;     // one past the last byte read
+    size_t scanned = 0; // bytes after begin known to hold no newline
+
+public:
+    KataGoLineFramer (size_t capacity = KATAGO_FRAMER_CAPACITY): buffer(capacity) {}
+
+    // Where the next read should go, and how much fits
+    std::pair<char*, size_t> prepare () {
+        if (buffer.size() - end < KATAGO_FRAMER_MIN_READ && begin > 0) {
+            std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        }
+
+        // A single line longer than the buffer
+        if (buffer.size() - end < KATAGO_FRAMER_MIN_READ) {
+            buffer.resize(buffer.size() * 2);
+        }
+
+        return {buffer.data() + end, buffer.size() - end};
+    }
+
+    // Counts size bytes written at prepare() as read
+    void commit (size_t size) { end += size; }
+
+    // Calls on_line with every complete line read so far, without its newline
+    template<typename Callback>
+    void forEachLine (Callback&& on_line) {
+        while (begin + scanned < end) {
+            const char* start = buffer.data() + begin;
+            const char* newline = static_cast<const char*>(
+                std::memchr(start + scanned, '\n', end - begin - scanned)
+            );
+
+            if (!newline) {
+                scanned = end - begin;
+                break;
+            }
+
+            on_line(std::string_view(start, newline - start));
+            begin += newline - start + 1;
+            scanned = 0;
+        }
+
+        if (begin == end) {
+            begin = end = 0;
+        }
+    }
+
+    // Bytes of an unfinished line
+    size_t getPendingSize () const { return end - begin; }
+    size_t getCapacity () const { return buffer.size(); }
+};
+
+#endif
@@ -0,0 +1,458 @@
+#include "katago_pool.hpp"
+#include <SDL3/SDL_log.h>
+#include <algorithm>
+
+
+KataGoEnginePool::KataGoEnginePool (
+    const std::string& katago_path,
+    const std::string& config_path,
+    const std::string& model_path,
+    int size,
+    std::function<void(bool)> init_callback
+):
+    katago_path(katago_path),
+    config_path(config_path),
+    model_path(model_path)
+{
+    // Checked once for the pool, restarts go straight to starting the process
+    is_init_failure = !KataGoEngine::isStartable(katago_path, config_path, model_path);
+
+    // Every process would fail the same way, so the first one to fail stops
+    // the others from starting
+    slots.resize(std::max(size, 1));
+    for (Slot& slot : slots) {
+        if (is_init_failure) break;
+
+        slot.engine = std::make_shared<KataGoEngine>(
+            katago_path, config_path, model_path, [this] { onExit(); }
+        );
+        slot.last_response = Clock::now();
+        is_init_failure = slot.engine->isInitFailure();
+    }
+
+    if (is_init_failure) {
+        init_callback(true);
+        return;
+    }
+
+    supervisor = std::thread(&KataGoEnginePool::supervise, this);
+}
+
+KataGoEnginePool::~KataGoEnginePool () {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        is_stopping = true;
+    }
+    wake.notify_all();
+    if (supervisor.joinable())
+        supervisor.join();
+
+    // Joins the reader threads before the handlers' pool state goes away
+    std::vector<std::shared_ptr<KataGoEngine>> stopped;
+    std::unordered_map<std::string, InFlight> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Slot& slot : slots) {
+            stopped.push_back(std::move(slot.engine));
+        }
+        dropped.swap(in_flight);
+    }
+    stopped.clear();
+
+    if (stats.answered > 0 || stats.restarts > 0) {
+        SDL_Log(
+            "[KataGo] %d queries answered in %.0f ms on average, %.0f ms at most. "
+            "%d restarts, %d hangs, %d queries replayed, %d timed out",
+            stats.answered, stats.getMeanLatencyMs(), stats.max_latency_ms,
+            stats.restarts, stats.hangs, stats.replayed, stats.timed_out
+        );
+    }
+}
+
+static std::chrono::milliseconds getRestartBackoff (int failed_starts) {
+    long backoff_ms = static_cast<long>(KATAGO_RESTART_BACKOFF_MIN_MS) << std::min(failed_starts, 16);
+    return std::chrono::milliseconds(std::min<long>(backoff_ms, KATAGO_RESTART_BACKOFF_MAX_MS));
+}
+
+std::string KataGoEnginePool::nextQueryId () {
+    return "q" + std::to_string(query_count.fetch_add(1));
+}
+
+void KataGoEnginePool::onExit () {
+    // Under the lock, so that the supervisor cannot miss it between looking
+    // at the processes and going to sleep
+    std::lock_guard<std::mutex> lock(mutex);
+    wake.notify_all();
+}
+
+std::shared_ptr<KataGoEngine> KataGoEnginePool::getLeastLoaded () {
+    std::shared_ptr<KataGoEngine> least_loaded = nullptr;
+    int least_load = 0;
+    for (const Slot& slot : slots) {
+        if (!slot.engine || slot.engine->hasExited())
+            continue;
+
+        int load = slot.engine->getLoad();
+        if (!least_loaded || load < least_load) {
+            least_loaded = slot.engine;
+            least_load = load;
+        }
+    }
+    return least_loaded;
+}
+
+bool KataGoEnginePool::assign (InFlight& query) {
+    std::shared_ptr<KataGoEngine> engine = getLeastLoaded();
+    if (!engine)
+        return false;
+
+    query.engine = engine;
+    query.deadline = Clock::now() + query_timeout;
+    if (query.attempts++ == 0)
+        return true;
+
+    // Turns already answered are not asked for again
+    stats.replayed++;
+    std::vector<int>& turns = query.query.analyze_turns;
+    turns.erase(std::remove_if(turns.begin(), turns.end(), [&](int turn) {
+        return std::find(query.answered_turns.begin(), query.answered_turns.end(), turn) != query.answered_turns.end();
+    }), turns.end());
+    return true;
+}
+
+void KataGoEnginePool::send (const std::string& id, const InFlight& query) {
+    const KataGoEngine* engine = query.engine.get();
+    std::string_view moves = query.moves ? std::string_view(*query.moves) : std::string_view();
+    query.engine->query(query.query, moves, [this, id, engine](const KataGoResponse& response) {
+        return onResponse(id, engine, response);
+    });
+}
+
+bool KataGoEnginePool::onResponse (const std::string& id, const KataGoEngine* engine, const KataGoResponse& response) {
+    std::shared_ptr<KataGoResponseHandler> handler;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = in_flight.find(id);
+        if (it == in_flight.end() || it->second.engine.get() != engine) {
+            // Cancelled, given up on, or sent again to another process
+            return true;
+        }
+
+        Clock::time_point now = Clock::now();
+        for (Slot& slot : slots) {
+            if (slot.engine.get() == engine) {
+                slot.last_response = now;
+                slot.failed_starts = 0;
+            }
+        }
+
+        InFlight& query = it->second;
+        query.deadline = now + query_timeout;
+        if (response.turn_number >= 0 && !response.is_during_search) {
+            query.answered_turns.push_back(response.turn_number);
+        }
+        handler = query.handler;
+    }
+
+    // Outside the lock, so a handler may send a follow up query
+    if (!(*handler)(response))
+        return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = in_flight.find(id);
+    if (it != in_flight.end() && it->second.handler == handler) {
+        double latency_ms = std::chrono::duration<double, std::milli>(Clock::now() - it->second.sent_at).count();
+        stats.answered++;
+        stats.total_latency_ms += latency_ms;
+        stats.max_latency_ms = std::max(stats.max_latency_ms, latency_ms);
+        in_flight.erase(it);
+    }
+    return true;
+}
+
+void KataGoEnginePool::supervise () {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!is_stopping) {
+        Clock::time_point now = Clock::now();
+        Clock::time_point next_check = Clock::time_point::max();
+
+        // Released and started outside the lock, a reader thread being
+        // joined may be waiting for it
+        std::vector<std::shared_ptr<KataGoEngine>> released;
+        std::vector<std::shared_ptr<KataGoEngine>> hung;
+        std::vector<size_t> starting;
+        std::vector<std::pair<std::string, InFlight>> to_send;
+        std::vector<std::pair<std::string, std::shared_ptr<KataGoResponseHandler>>> failed;
+
+        for (size_t i = 0; i < slots.size(); i++) {
+            Slot& slot = slots[i];
+            if (slot.engine && slot.engine->hasExited()) {
+                for (auto& [id, query] : in_flight) {
+                    if (query.engine != slot.engine) continue;
+                    query.engine = nullptr;
+                    query.deadline = now + query_timeout;
+                }
+                released.push_back(std::move(slot.engine));
+
+                std::chrono::milliseconds backoff = getRestartBackoff(slot.failed_starts++);
+                slot.restart_at = now + backoff;
+                SDL_Log("[KataGo] Process %zu exited, starting it again in %d ms", i, static_cast<int>(backoff.count()));
+            }
+
+            if (!slot.engine) {
+                if (now >= slot.restart_at) {
+                    starting.push_back(i);
+                } else {
+                    next_check = std::min(next_check, slot.restart_at);
+                }
+            }
+        }
+
+        for (auto it = in_flight.begin(); it != in_flight.end();) {
+            const std::string& id = it->first;
+            InFlight& query = it->second;
+
+            if (!query.engine && (query.attempts >= KATAGO_QUERY_MAX_ATTEMPTS || now >= query.deadline)) {
+                SDL_Log(
+                    query.attempts >= KATAGO_QUERY_MAX_ATTEMPTS ?
+                        "[KataGo] Giving up on %s, %d processes exited while on it" :
+                        "[KataGo] Giving up on %s, no process to run it after %d attempts",
+                    id.c_str(), query.attempts
+                );
+                stats.timed_out++;
+                failed.push_back({id, std::move(query.handler)});
+                it = in_flight.erase(it);
+                continue;
+            }
+
+            if (!query.engine) {
+                if (assign(query)) {
+                    to_send.push_back({id, query});
+                }
+            } else if (now >= query.deadline) {
+                // Overdue, the process is hung if nothing else came out of it
+                for (const Slot& slot : slots) {
+                    if (slot.engine == query.engine && now - slot.last_response >= query_timeout
+                            && std::find(hung.begin(), hung.end(), query.engine) == hung.end()) {
+                        SDL_Log("[KataGo] Killing a process silent for %lld ms with %s waiting",
+                            static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(now - slot.last_response).count()),
+                            id.c_str());
+                        stats.hangs++;
+                        hung.push_back(query.engine);
+                    }
+                }
+                query.deadline = now + query_timeout;
+            }
+
+            next_check = std::min(next_check, query.deadline);
+            it++;
+        }
+
+        if (released.empty() && hung.empty() && starting.empty() && to_send.empty() && failed.empty()) {
+            if (next_check == Clock::time_point::max()) {
+                wake.wait(lock);
+            } else {
+                wake.wait_until(lock, next_check);
+            }
+            continue;
+        }
+
+        lock.unlock();
+        for (const std::shared_ptr<KataGoEngine>& engine : hung) {
+            engine->forceExit();
+        }
+        for (const auto& [id, query] : to_send) {
+            send(id, query);
+        }
+        released.clear();
+
+        // Answered with an error, so a review counts the turns and goes on
+        for (const auto& [id, handler] : failed) {
+            KataGoResponse response;
+            response.id = id;
+            response.error = "No analysis process answered";
+            (*handler)(response);
+        }
+        failed.clear();
+
+        std::vector<std::shared_ptr<KataGoEngine>> started;
+        for (size_t n = starting.size(); n > 0; n--) {
+            started.push_back(std::make_shared<KataGoEngine>(
+                katago_path, config_path, model_path, [this] { onExit(); }
+            ));
+        }
+        lock.lock();
+
+        for (size_t i = 0; i < starting.size(); i++) {
+            Slot& slot = slots[starting[i]];
+            slot.is_start_failed = started[i]->isInitFailure();
+            if (slot.is_start_failed) {
+                // Tried again after a backoff, as if it exited at once
+                slot.restart_at = Clock::now() + getRestartBackoff(slot.failed_starts++);
+                released.push_back(std::move(started[i]));
+                continue;
+            }
+
+            slot.engine = std::move(started[i]);
+            slot.last_response = Clock::now();
+            stats.restarts++;
+        }
+
+        if (!released.empty()) {
+            lock.unlock();
+            released.clear();
+            lock.lock();
+        }
+    }
+}
+
+void KataGoEnginePool::query (const KataGoQuery& query, KataGoMoves moves, KataGoResponseHandler handler) {
+    if (is_init_failure)
+        return;
+
+    const std::string& id = query.id;
+    std::optional<InFlight> to_send;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (cancelled.erase(id))
+            return;
+
+        InFlight& entry = in_flight[id];
+        entry.query = query;
+        entry.moves = std::move(moves);
+        entry.handler = std::make_shared<KataGoResponseHandler>(std::move(handler));
+        entry.sent_at = Clock::now();
+        entry.deadline = entry.sent_at + query_timeout;
+
+        if (assign(entry)) {
+            to_send = entry;
+        }
+
+        // For its deadline, or to send it once a process is up
+        wake.notify_all();
+    }
+
+    if (to_send.has_value()) {
+        send(id, to_send.value());
+    }
+}
+
+void KataGoEnginePool::cancel (const std::string& id) {
+    if (is_init_failure)
+        return;
+
+    std::shared_ptr<KataGoEngine> engine;
+    std::shared_ptr<KataGoResponseHandler> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = in_flight.find(id);
+        if (it == in_flight.end()) {
+            if (!cancelled.insert(id).second)
+                return;
+
+            cancelled_order.push_back(id);
+            if (cancelled_order.size() > KATAGO_CANCELLED_IDS_KEPT) {
+                cancelled.erase(cancelled_order.front());
+                cancelled_order.pop_front();
+            }
+            return;
+        }
+
+        engine = it->second.engine;
+        dropped = std::move(it->second.handler);
+        in_flight.erase(it);
+    }
+
+    if (engine) {
+        engine->cancel(id);
+    }
+}
+
+bool KataGoEnginePool::isDown () {
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::all_of(slots.begin(), slots.end(), [](const Slot& slot) {
+        return !slot.engine && slot.is_start_failed;
+    });
+}
+
+KataGoPoolStats KataGoEnginePool::getStats () {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void KataGoEnginePool::setQueryTimeout (std::chrono::milliseconds timeout) {
+    std::lock_guard<std::mutex> lock(mutex);
+    query_timeout = timeout;
+}
+
+std::future<KataGoResponse> KataGoEnginePool::query (const KataGoQuery& query, KataGoMoves moves) {
+    auto promise = std::make_shared<std::promise<KataGoResponse>>();
+    std::future<KataGoResponse> response = promise->get_future();
+
+    if (is_init_failure) {
+        promise->set_value(KataGoResponse());
+        return response;
+    }
+
+    this->query(query, std::move(moves), [promise](const KataGoResponse& msg) {
+        if (msg.is_during_search)
+            return false;
+
+        promise->set_value(msg);
+        return true;
+    });
+    return response;
+}
+
+std::optional<std::vector<std::string>>
+KataGoEnginePool::getNextMove (const KataGoQuery& query, KataGoMoves moves) {
+    if (is_init_failure)
+        return std::nullopt;
+
+    try {
+        return KataGoEngine::parseNextMove(this->query(query, std::move(moves)).get());
+    } catch (const std::future_error&) {
+        // The process exited or the query was cancelled before answering
+        return std::nullopt;
+    }
+}
+
+std::optional<KataGoEvaluation>
+KataGoEnginePool::getEvaluation (
+    const KataGoQuery& query,
+    KataGoMoves moves,
+    std::function<void(const KataGoEvaluation&)> on_partial
+) {
+    if (is_init_failure)
+        return std::nullopt;
+
+    if (!on_partial) {
+        try {
+            return KataGoEngine::parseEvaluation(this->query(query, std::move(moves)).get());
+        } catch (const std::future_error&) {
+            return std::nullopt;
+        }
+    }
+
+    auto promise = std::make_shared<std::promise<KataGoResponse>>();
+    std::future<KataGoResponse> response = promise->get_future();
+
+    this->query(query, std::move(moves), [promise, on_partial](const KataGoResponse& msg) {
+        if (msg.is_during_search) {
+            // Early snapshots may come before there is anything to report
+            if (KataGoEngine::isEvaluation(msg)) {
+                on_partial(KataGoEngine::parseEvaluation(msg).value());
+            }
+            return false;
+        }
+
+        promise->set_value(msg);
+        return true;
+    });
+
+    try {
+        return KataGoEngine::parseEvaluation(response.get());
+    } catch (const std::future_error&) {
+        return std::nullopt;
+    }
+}
@@ -0,0 +1,167 @@
+#ifndef GO_KATAGO_POOL_H
+#define GO_KATAGO_POOL_H
+
+#include "katago_engine.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// A query that hears nothing back for this long is overdue. Its process is
+// taken for hung when it was silent for as long.
+#define KATAGO_QUERY_TIMEOUT_MS 120000
+
+// Processes a query may be sent to before it is given up on, so that a query
+// crashing KataGo does not do so forever
+#define KATAGO_QUERY_MAX_ATTEMPTS 3
+
+// Wait before starting a process again, doubled for every start in a row
+// that exits before answering anything
+#define KATAGO_RESTART_BACKOFF_MIN_MS 500
+#define KATAGO_RESTART_BACKOFF_MAX_MS 30000
+
+struct KataGoPoolStats {
+    int answered = 0;
+    int restarts = 0;  // processes started again after exiting
+    int hangs = 0;     // processes killed for not answering
+    int replayed = 0;  // queries sent again to another process
+    int timed_out = 0; // queries given up on
+
+    // From sending a query to its final response, replays included
+    double total_latency_ms = 0;
+    double max_latency_ms = 0;
+
+    double getMeanLatencyMs () const { return answered > 0 ? total_latency_ms / answered : 0; }
+};
+
+// Several KataGo analysis processes behind one query interface. Each query
+// goes to the process with the fewest unanswered queries.
+//
+// A supervisor thread keeps the processes alive. One that exits, or stays
+// silent past KATAGO_QUERY_TIMEOUT_MS with a query overdue, is started again
+// after a backoff, and the queries it had are sent again, to whichever
+// process is up first. Callers only see the delay. A query is only given up
+// on when it is overdue without a process to run it or ran out of attempts,
+// its handler then gets a response with an error.
+class KataGoEnginePool {
+    typedef std::chrono::steady_clock Clock;
+
+    struct Slot {
+        std::shared_ptr<KataGoEngine> engine; // null until restart_at
+        Clock::time_point restart_at;
+        Clock::time_point last_response;
+        int failed_starts = 0; // in a row without an answer, for the backoff
+        bool is_start_failed = false;
+    };
+
+    struct InFlight {
+        KataGoQuery query;
+        KataGoMoves moves;
+        std::shared_ptr<KataGoResponseHandler> handler;
+
+        // Null while waiting for a process
+        std::shared_ptr<KataGoEngine> engine;
+        int attempts = 0;
+        Clock::time_point sent_at;
+        Clock::time_point deadline;
+
+        // Turns of an analyzeTurns query already answered, left out of a
+        // replay
+        std::vector<int> answered_turns;
+    };
+
+    std::string katago_path;
+    std::string config_path;
+    std::string model_path;
+
+    bool is_init_failure = false;
+    std::atomic<uint64_t> query_count{0};
+    std::chrono::milliseconds query_timeout{KATAGO_QUERY_TIMEOUT_MS};
+
+    std::mutex mutex;
+    std::vector<Slot> slots;
+    std::unordered_map<std::string, InFlight> in_flight;
+
+    // Cancelled before they reached a process, or after they were answered.
+    // Only the last KATAGO_CANCELLED_IDS_KEPT are kept, as in the dispatcher.
+    std::unordered_set<std::string> cancelled;
+    std::deque<std::string> cancelled_order;
+
+    KataGoPoolStats stats;
+
+    std::thread supervisor;
+    std::condition_variable wake;
+    bool is_stopping = false;
+
+    void onExit ();
+    std::shared_ptr<KataGoEngine> getLeastLoaded ();
+
+    // Hands the query to the least loaded process, under the lock. False
+    // when none is up.
+    bool assign (InFlight& query);
+    void send (const std::string& id, const InFlight& query);
+    bool onResponse (const std::string& id, const KataGoEngine* engine, const KataGoResponse& response);
+
+    void supervise ();
+
+public:
+    KataGoEnginePool (
+        const std::string& katago_path,
+        const std::string& config_path,
+        const std::string& model_path,
+        int size,
+        std::function<void(bool)> init_callback
+    );
+
+    ~KataGoEnginePool ();
+
+    // Unique across the processes of the pool
+    std::string nextQueryId ();
+
+    int getSize () const { return slots.size(); }
+
+    // Same contract as KataGoEngine::query, on whichever process is least
+    // loaded
+    void query (const KataGoQuery& query, KataGoMoves moves, KataGoResponseHandler handler);
+    void cancel (const std::string& id);
+
+    // Resolves with the final response to the query, snapshots sent while
+    // the search runs are skipped
+    std::future<KataGoResponse> query (const KataGoQuery& query, KataGoMoves moves = nullptr);
+
+    // Send the query and wait for its response only, other queries may
+    // be answered in between
+    std::optional<std::vector<std::string>>
+        getNextMove (const KataGoQuery& query, KataGoMoves moves = nullptr);
+
+    // With reportDuringSearchEvery in the query, on_partial gets every
+    // snapshot before the final result, on a reader thread
+    std::optional<KataGoEvaluation>
+        getEvaluation (
+            const KataGoQuery& query,
+            KataGoMoves moves = nullptr,
+            std::function<void(const KataGoEvaluation&)> on_partial = nullptr
+        );
+
+    // Every process failed to start the last time it was tried
+    bool isDown ();
+
+    KataGoPoolStats getStats ();
+    void setQueryTimeout (std::chrono::milliseconds timeout);
+
+    KataGoEnginePool(const KataGoEnginePool&) = delete;
+    KataGoEnginePool& operator=(const KataGoEnginePool&) = delete;
+};
+
+#endif
@@ -0,0 +1,174 @@
+#include "katago_query.hpp"
+#include <charconv>
+
+void appendKataGoMove (std::string& out, int size, GoPackedMove move) {
+    if (!out.empty()) out += ',';
+
+    out += getPackedTurn(move) == GoTurn::BLACK ? "[\"B\",\"" : "[\"W\",\"";
+    if (isPackedPass(move)) {
+        out += "pass";
+    } else {
+        int index = getPackedIndex(move);
+        out += KATAGO_COLUMNS[index % size];
+        out += KATAGO_ROWS[size - index / size];
+    }
+    out += "\"]";
+}
+
+void appendKataGoMove (std::string& out, std::string_view player, std::string_view move) {
+    if (!out.empty()) out += ',';
+
+    out += "[\"";
+    out += player;
+    out += "\",\"";
+    out += move;
+    out += "\"]";
+}
+
+std::string& KataGoMoveList::getWritableText () {
+    // Only this list hands the text out, so a count of one stays one
+    if (text.use_count() > 1) {
+        text = std::make_shared<std::string>(*text);
+    }
+    return *text;
+}
+
+KataGoMoves KataGoMoveList::update (GoBoardSize size, const GoGameLine& line) {
+    if (static_cast<int>(size) != this->size) {
+        this->size = static_cast<int>(size);
+        nodes.clear();
+        ends.clear();
+        getWritableText().clear();
+    }
+
+    // Up to the last node the two lines share
+    std::vector<const GoGameNode*> added;
+    const GoGameNode* node = line.get();
+    for (; !node->isRoot(); node = node->parent.get()) {
+        size_t index = node->move_number - 1;
+        if (index < nodes.size() && nodes[index] == node)
+            break;
+        added.push_back(node);
+    }
+
+    // The same line again keeps handing out the same text
+    size_t kept = node->move_number;
+    if (kept < nodes.size() || !added.empty()) {
+        std::string& out = getWritableText();
+        nodes.resize(kept);
+        ends.resize(kept);
+        out.resize(kept > 0 ? ends[kept - 1] : 0);
+
+        for (auto it = added.rbegin(); it != added.rend(); it++) {
+            appendKataGoMove(out, this->size, (*it)->move);
+            nodes.push_back(*it);
+            ends.push_back(out.size());
+        }
+    }
+
+    this->line = line;
+    return text;
+}
+
+// Only our own ids and rule names go through here, quotes and backslashes
+// are all that needs escaping
+static void appendQueryString (std::string& out, std::string_view value) {
+    out += '"';
+    for (char c : value) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    out += '"';
+}
+
+template <typename Number>
+static void appendQueryNumber (std::string& out, Number value) {
+    char buffer[32];
+    std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, result.ptr);
+}
+
+static void appendQueryKey (std::string& out, std::string_view key) {
+    out += ",\"";
+    out += key;
+    out += "\":";
+}
+
+void writeKataGoQuery (std::string& out, const KataGoQuery& query, std::string_view moves) {
+    out.clear();
+    out += "{\"id\":";
+    appendQueryString(out, query.id);
+
+    appendQueryKey(out, "rules");
+    appendQueryString(out, query.rules);
+    appendQueryKey(out, "komi");
+    appendQueryNumber(out, query.komi);
+    appendQueryKey(out, "boardXSize");
+    appendQueryNumber(out, query.board_size);
+    appendQueryKey(out, "boardYSize");
+    appendQueryNumber(out, query.board_size);
+
+    if (query.max_visits.has_value()) {
+        appendQueryKey(out, "maxVisits");
+        appendQueryNumber(out, query.max_visits.value());
+    }
+    if (query.root_policy_temperature.has_value()) {
+        appendQueryKey(out, "rootPolicyTemperature");
+        appendQueryNumber(out, query.root_policy_temperature.value());
+    }
+    if (query.root_fpu_reduction_max.has_value()) {
+        appendQueryKey(out, "rootFpuReductionMax");
+        appendQueryNumber(out, query.root_fpu_reduction_max.value());
+    }
+    if (query.report_during_search_every.has_value()) {
+        appendQueryKey(out, "reportDuringSearchEvery");
+        appendQueryNumber(out, query.report_during_search_every.value());
+    }
+    if (query.priority.has_value()) {
+        appendQueryKey(out, "priority");
+        appendQueryNumber(out, query.priority.value());
+    }
+    if (query.include_ownership) {
+        appendQueryKey(out, "includeOwnership");
+        out += "true";
+    }
+
+    if (!query.analyze_turns.empty()) {
+        appendQueryKey(out, "analyzeTurns");
+        out += '[';
+        for (size_t i = 0; i < query.analyze_turns.size(); i++) {
+            if (i > 0) out += ',';
+            appendQueryNumber(out, query.analyze_turns[i]);
+        }
+        out += ']';
+    }
+
+    if (!query.avoid_moves.empty()) {
+        appendQueryKey(out, "avoidMoves");
+        out += '[';
+        for (size_t i = 0; i < query.avoid_moves.size(); i++) {
+            const KataGoAvoidMoves& avoid = query.avoid_moves[i];
+            if (i > 0) out += ',';
+            out += "{\"player\":";
+            appendQueryString(out, avoid.player);
+            appendQueryKey(out, "moves");
+            out += '[';
+            for (size_t j = 0; j < avoid.moves.size(); j++) {
+                if (j > 0) out += ',';
+                appendQueryString(out, avoid.moves[j]);
+            }
+            out += ']';
+            appendQueryKey(out, "untilDepth");
+            appendQueryNumber(out, avoid.until_depth);
+            out += '}';
+        }
+        out += ']';
+    }
+
+    appendQueryKey(out, "moves");
+    out += '[';
+    out += moves;
+    if (!moves.empty() && !query.next_moves.empty()) out += ',';
+    out += query.next_moves;
+    out += "]}\n";
+}
@@ -0,0 +1,91 @@
+#ifndef GO_KATAGO_QUERY_H
+#define GO_KATAGO_QUERY_H
+
+#include "actions.hpp"
+#include "base.hpp"
+#include "tree.hpp"
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// GTP column letters, I is skipped
+constexpr std::string_view KATAGO_COLUMNS = "ABCDEFGHJKLMNOPQRST";
+
+// GTP row labels, indexed by the row number
+constexpr std::array<std::string_view, 20> KATAGO_ROWS = {
+    "", "1", "2", "3", "4", "5", "6", "7", "8", "9", "10",
+    "11", "12", "13", "14", "15", "16", "17", "18", "19"
+};
+
+// Append one move as KataGo reads it, ["B","Q16"], after a comma unless
+// out is empty
+void appendKataGoMove (std::string& out, int size, GoPackedMove move);
+void appendKataGoMove (std::string& out, std::string_view player, std::string_view move);
+
+// The inside of a query's "moves" array. Shared by the queries sent with
+// it, including those kept to be sent again, rather than copied into each.
+typedef std::shared_ptr<const std::string> KataGoMoves;
+
+// The moves of a line, written out as the inside of a query's "moves"
+// array. Kept from one query to the next: moving on along the line only
+// writes the new moves, going back or to another variation first cuts the
+// text back to where the lines part. Text still held by a query is copied
+// before it is changed.
+class KataGoMoveList {
+    int size = 0;
+
+    // Holds the nodes below alive, so that they can be compared by address
+    GoGameLine line;
+    std::vector<const GoGameNode*> nodes; // nodes[i] played move i + 1
+    std::vector<size_t> ends;             // text size after each move
+
+    std::shared_ptr<std::string> text = std::make_shared<std::string>();
+
+    std::string& getWritableText ();
+
+public:
+    KataGoMoves update (GoBoardSize size, const GoGameLine& line);
+
+    const std::string& getText () const { return *text; }
+    int getCount () const { return nodes.size(); }
+};
+
+struct KataGoAvoidMoves {
+    std::string player;
+    std::vector<std::string> moves; // "Q16"
+    int until_depth = 1;
+};
+
+// An analysis query as KataGo reads it. Written out by writeKataGoQuery
+// field by field, optional ones only when set.
+struct KataGoQuery {
+    std::string id;
+
+    std::string rules = "japanese";
+    double komi = 6.5;
+    int board_size = 19;
+
+    std::optional<int> max_visits;
+    std::optional<double> root_policy_temperature;
+    std::optional<double> root_fpu_reduction_max;
+    std::optional<double> report_during_search_every;
+    std::optional<int> priority;
+    bool include_ownership = false;
+
+    // Every position of the line when set, the last one otherwise
+    std::vector<int> analyze_turns;
+    std::vector<KataGoAvoidMoves> avoid_moves;
+
+    // Played after the moves the query is sent with, in the same format
+    std::string next_moves;
+};
+
+// Writes query into out as one line, moves then its next_moves as the
+// "moves" array. out is reused from one query to the next.
+void writeKataGoQuery (std::string& out, const KataGoQuery& query, std::string_view moves);
+
+#endif
@@ -0,0 +1,247 @@
+#include "katago_response.hpp"
+#include <algorithm>
+#include <charconv>
+
+// Deeper values are not KataGo's and not worth following
+#define KATAGO_RESPONSE_MAX_DEPTH 64
+
+void KataGoResponse::clear () {
+    id.clear();
+    turn_number = -1;
+    is_during_search = false;
+    error.clear();
+    warning.clear();
+    has_score_lead = false;
+    score_lead = 0;
+    current_player.clear();
+    move_infos.clear();
+    has_ownership = false;
+    ownership.clear();
+}
+
+bool KataGoResponseDecoder::decode (std::string_view line, KataGoResponse& response) {
+    response.clear();
+    KataGoResponseDecoder decoder(line, response);
+
+    bool is_read = decoder.readObject([&](std::string_view key) {
+        if (key == "id") return decoder.readString(response.id);
+        if (key == "turnNumber") return decoder.readInt(response.turn_number);
+        if (key == "isDuringSearch") return decoder.readBool(response.is_during_search);
+        if (key == "error") return decoder.readString(response.error);
+        if (key == "warning") return decoder.readString(response.warning);
+        if (key == "rootInfo") return decoder.readRootInfo();
+        if (key == "moveInfos") return decoder.readArray([&] { return decoder.readMoveInfo(); });
+
+        if (key == "ownership") {
+            response.has_ownership = true;
+            return decoder.readArray([&] {
+                double value;
+                if (!decoder.readNumber(value)) return false;
+                response.ownership.push_back(value);
+                return true;
+            });
+        }
+        return decoder.skipValue();
+    });
+
+    // Nothing but whitespace after the object
+    return is_read && !decoder.skipSpace();
+}
+
+bool KataGoResponseDecoder::readRootInfo () {
+    return readObject([&](std::string_view key) {
+        if (key == "scoreLead") {
+            response.has_score_lead = true;
+            return readNumber(response.score_lead);
+        }
+        if (key == "currentPlayer") return readString(response.current_player);
+        return skipValue();
+    });
+}
+
+bool KataGoResponseDecoder::readMoveInfo () {
+    response.move_infos.push_back({"", 0, 0, 0});
+    KataGoCandidate& info = response.move_infos.back();
+
+    return readObject([&](std::string_view key) {
+        if (key == "move") return readString(info.move);
+        if (key == "visits") return readInt(info.visits);
+        if (key == "winrate") return readNumber(info.winrate);
+        if (key == "scoreLead") return readNumber(info.score_lead);
+        return skipValue();
+    });
+}
+
+// False at the end of the line
+bool KataGoResponseDecoder::skipSpace () {
+    while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n')) {
+        cursor++;
+    }
+    return cursor < end;
+}
+
+bool KataGoResponseDecoder::consume (char c) {
+    if (!skipSpace() || *cursor != c)
+        return false;
+
+    cursor++;
+    return true;
+}
+
+template<typename Callback>
+bool KataGoResponseDecoder::readObject (Callback&& on_field) {
+    if (!consume('{'))
+        return false;
+    if (consume('}'))
+        return true;
+
+    do {
+        std::string_view key;
+        if (!readKey(key) || !consume(':') || !on_field(key))
+            return false;
+    } while (consume(','));
+
+    return consume('}');
+}
+
+template<typename Callback>
+bool KataGoResponseDecoder::readArray (Callback&& on_item) {
+    if (!consume('['))
+        return false;
+    if (consume(']'))
+        return true;
+
+    do {
+        if (!on_item())
+            return false;
+    } while (consume(','));
+
+    return consume(']');
+}
+
+bool KataGoResponseDecoder::readKey (std::string_view& key) {
+    if (!consume('"'))
+        return false;
+
+    const char* start = cursor;
+    while (cursor < end && *cursor != '"') {
+        // An escaped quote does not end the key
+        if (*cursor == '\\') cursor++;
+        cursor++;
+    }
+    if (cursor >= end)
+        return false;
+
+    key = std::string_view(start, cursor - start);
+    cursor++;
+    return true;
+}
+
+bool KataGoResponseDecoder::readString (std::string& value) {
+    if (!consume('"'))
+        return false;
+
+    value.clear();
+    while (cursor < end && *cursor != '"') {
+        const char* start = cursor;
+        while (cursor < end && *cursor != '"' && *cursor != '\\') cursor++;
+        value.append(start, cursor - start);
+
+        if (cursor + 1 < end && *cursor == '\\') {
+            char escaped = cursor[1];
+            cursor += 2;
+            switch (escaped) {
+                case 'n': value += '\n'; break;
+                case 't': value += '\t'; break;
+                case 'r': value += '\r'; break;
+                case 'b': value += '\b'; break;
+                case 'f': value += '\f'; break;
+                case 'u': {
+                    // Only in messages we log, anything past ASCII becomes '?'
+                    unsigned int code = 0;
+                    auto result = std::from_chars(cursor, std::min(cursor + 4, end), code, 16);
+                    if (result.ptr != cursor + 4) return false;
+                    value += code < 0x80 ? static_cast<char>(code) : '?';
+                    cursor += 4;
+                    break;
+                }
+                default: value += escaped; break;
+            }
+        } else if (cursor < end && *cursor == '\\') {
+            return false;
+        }
+    }
+    if (cursor >= end)
+        return false;
+
+    cursor++;
+    return true;
+}
+
+bool KataGoResponseDecoder::readNumber (double& value) {
+    if (!skipSpace())
+        return false;
+
+    auto result = std::from_chars(cursor, end, value);
+    if (result.ec != std::errc())
+        return false;
+
+    cursor = result.ptr;
+    return true;
+}
+
+bool KataGoResponseDecoder::readInt (int& value) {
+    double number;
+    if (!readNumber(number))
+        return false;
+
+    value = static_cast<int>(number);
+    return true;
+}
+
+bool KataGoResponseDecoder::readBool (bool& value) {
+    if (!skipSpace())
+        return false;
+
+    if (end - cursor >= 4 && std::string_view(cursor, 4) == "true") {
+        value = true;
+        cursor += 4;
+        return true;
+    }
+    if (end - cursor >= 5 && std::string_view(cursor, 5) == "false") {
+        value = false;
+        cursor += 5;
+        return true;
+    }
+    return false;
+}
+
+bool KataGoResponseDecoder::skipValue (int depth) {
+    if (!skipSpace() || depth > KATAGO_RESPONSE_MAX_DEPTH)
+        return false;
+
+    switch (*cursor) {
+        case '{':
+            return readObject([&](std::string_view) { return skipValue(depth + 1); });
+        case '[':
+            return readArray([&] { return skipValue(depth + 1); });
+        case '"': {
+            std::string_view skipped;
+            return readKey(skipped);
+        }
+        case 't':
+        case 'f': {
+            bool skipped;
+            return readBool(skipped);
+        }
+        case 'n':
+            if (end - cursor < 4 || std::string_view(cursor, 4) != "null")
+                return false;
+            cursor += 4;
+            return true;
+        default: {
+            double skipped;
+            return readNumber(skipped);
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef GO_KATAGO_RESPONSE_H
+#define GO_KATAGO_RESPONSE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// One of the moves the engine searched, best first
+struct KataGoCandidate {
+    std::string move;
+    int visits;
+    double winrate;
+    double score_lead;
+};
+
+// The fields of an analysis response we use, everything else KataGo sends
+// is skipped while decoding
+struct KataGoResponse {
+    std::string id;
+    int turn_number = -1;
+    bool is_during_search = false;
+
+    // Text of the "error" or "warning" field, if any
+    std::string error;
+    std::string warning;
+
+    bool has_score_lead = false;
+    double score_lead = 0;
+    std::string current_player;
+
+    std::vector<KataGoCandidate> move_infos;
+    bool has_ownership = false;
+    std::vector<double> ownership;
+
+    // Room for a 19x19 response, so that decoding into a reused response
+    // does not allocate
+    KataGoResponse () {
+        move_infos.reserve(64);
+        ownership.reserve(19 * 19);
+    }
+
+    // Keeps the capacity of the vectors
+    void clear ();
+};
+
+// Reads the fields of KataGoResponse straight out of a line of KataGo
+// output, without building a json DOM. Values of other fields, such as the
+// pv of a move or the policy, are only scanned past. Numbers are converted
+// with from_chars, with no copy of their text.
+class KataGoResponseDecoder {
+    const char* cursor;
+    const char* end;
+    KataGoResponse& response;
+
+    KataGoResponseDecoder (std::string_view line, KataGoResponse& response):
+        cursor(line.data()), end(line.data() + line.size()), response(response) {}
+
+    bool skipSpace ();
+    bool consume (char c);
+
+    // Calls on_field with every key of an object, which must read its value
+    template<typename Callback> bool readObject (Callback&& on_field);
+    // Calls on_item for every item of an array, which must read it
+    template<typename Callback> bool readArray (Callback&& on_item);
+
+    // Without escapes decoded, only used for keys
+    bool readKey (std::string_view& key);
+    bool readString (std::string& value);
+    bool readNumber (double& value);
+    bool readInt (int& value);
+    bool readBool (bool& value);
+    bool skipValue (int depth = 0);
+
+    bool readRootInfo ();
+    bool readMoveInfo ();
+
+public:
+    // Fills response from one line of KataGo output, false when the line is
+    // not a JSON object
+    static bool decode (std::string_view line, KataGoResponse& response);
+};
+
+#endif
@@ -1,12 +1,24 @@
 #include "katago_settings.hpp"
 #include "utils.hpp"
 
+#include <SDL3/SDL_log.h>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
 #include <iostream>
 #include <fstream>
 #include <optional>
 #include <sstream>
 #include <string>
 
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
 KataGoSetting getDefaultSetting (KataGoLevel level) {
     switch (level) {
         case KataGoLevel::LEVEL_4:
@@ -29,13 +41,46 @@ KataGoSetting getDefaultSetting (KataGoLevel level) {
     }
 }
 
-KataGoSetting KataGoSettings::getSetting (KataGoLevel level) {
+std::shared_ptr<const KataGoSettingsSnapshot> KataGoSettings::snapshot = nullptr;
+
+static KataGoSetting readSetting (const nlohmann::json& parsed_json, KataGoLevel level) {
+    if (level == KataGoLevel::EVAL) {
+        nlohmann::json evaluation = parsed_json.value("evaluation", nlohmann::json::object());
+        KataGoSetting setting;
+        setting.max_visits = getJSONOrDefault(evaluation, "maxVisits", 20);
+        setting.temprature = getJSONOrDefault(evaluation, "rootPolicyTemperature", 1.4);
+        setting.fpu_red_max = getJSONOrDefault(evaluation, "rootFpuReductionMax", 0.0);
+        return setting;
+    }
+
+    std::string level_str = getLevelString(level);
+    if (!parsed_json.contains("levels")
+            || !parsed_json["levels"].contains(level_str))
+    {
+        std::cerr << "No " << level_str << " in the katago settings file, loading its default settings" << std::endl;
+        return getDefaultSetting(level);
+    }
+
+    KataGoSetting setting;
+    setting.max_visits = getJSONOrDefault(parsed_json["levels"][level_str], "maxVisits", 20);
+    setting.temprature = getJSONOrDefault(parsed_json["levels"][level_str], "rootPolicyTemperature", 1.4);
+    setting.fpu_red_max = getJSONOrDefault(parsed_json["levels"][level_str], "rootFpuReductionMax", 0.0);
+    return setting;
+}
+
+bool KataGoSettings::load (const std::string& path) {
+    auto loaded = std::make_shared<KataGoSettingsSnapshot>();
+    for (int level = 0; level < loaded->settings.size(); level++) {
+        loaded->settings[level] = getDefaultSetting(static_cast<KataGoLevel>(level));
+    }
+
     //try to read from file, if not found fallback to defaults
-    std::ifstream input_file("./assets/KataGo/config/settings.json");
+    std::ifstream input_file(path);
 
     if (!input_file.is_open()) {
         std::cerr << "Error opening the katago settings file, loading default settings" << std::endl;
-        return getDefaultSetting(level);
+        std::atomic_store(&snapshot, std::shared_ptr<const KataGoSettingsSnapshot>(loaded));
+        return false;
     }
 
     try {
@@ -45,44 +90,150 @@ KataGoSetting KataGoSettings::getSetting (KataGoLevel level) {
         input_file.close();
 
         nlohmann::json parsed_json = nlohmann::json::parse(file_content);
-        if (level == KataGoLevel::EVAL) {
-            KataGoSetting setting;
-            setting.max_visits = getJSONOrDefault(parsed_json["evaluation"], "maxVisits", 20);
-            setting.temprature = getJSONOrDefault(parsed_json["evaluation"], "rootPolicyTemperature", 1.4);
-            setting.fpu_red_max = getJSONOrDefault(parsed_json["evaluation"], "rootFpuReductionMax", 0.0);
-            return setting;
+        for (int level = 0; level < loaded->settings.size(); level++) {
+            loaded->settings[level] = readSetting(parsed_json, static_cast<KataGoLevel>(level));
         }
-
-        std::string level_str = getLevelString(level);
-        if (!parsed_json.contains("levels")
-                || !parsed_json["levels"].contains(level_str))
-        {
-            throw std::runtime_error("Json error");
-        }
-
-        KataGoSetting setting;
-        setting.max_visits = getJSONOrDefault(parsed_json["levels"][level_str], "maxVisits", 20);
-        setting.temprature = getJSONOrDefault(parsed_json["levels"][level_str], "rootPolicyTemperature", 1.4);
-        setting.fpu_red_max = getJSONOrDefault(parsed_json["levels"][level_str], "rootFpuReductionMax", 0.0);
-        return setting;
     } catch (...) {
+        if (std::atomic_load(&snapshot)) {
+            std::cerr << "Error parsing the katago settings file, keeping the current settings" << std::endl;
+            return false;
+        }
         std::cerr << "Error parsing the katago settings file, loading default settings" << std::endl;
+        std::atomic_store(&snapshot, std::shared_ptr<const KataGoSettingsSnapshot>(loaded));
+        return false;
+    }
+
+    std::atomic_store(&snapshot, std::shared_ptr<const KataGoSettingsSnapshot>(loaded));
+    return true;
+}
+
+std::shared_ptr<const KataGoSettingsSnapshot> KataGoSettings::getSnapshot () {
+    std::shared_ptr<const KataGoSettingsSnapshot> current = std::atomic_load(&snapshot);
+    if (!current) {
+        load();
+        current = std::atomic_load(&snapshot);
     }
+    return current;
+}
 
-    return getDefaultSetting(level);
+void KataGoSettings::applyDiffLevel (KataGoQuery& query, KataGoLevel level) {
+    const KataGoSetting& setting = getSnapshot()->get(level);
+    query.max_visits = setting.max_visits;
+    query.root_policy_temperature = setting.temprature;
+    query.root_fpu_reduction_max = setting.fpu_red_max;
 }
 
-void KataGoSettings::applyDiffLevel (json& req, KataGoLevel level) {
-    KataGoSetting setting = getSetting(level);
-    req["maxVisits"] = setting.max_visits;
-    req["rootPolicyTemperature"] = setting.temprature;
-    req["rootFpuReductionMax"] = setting.fpu_red_max;
+void KataGoSettings::applyEvaluationConfig (KataGoQuery& query) {
+    const KataGoSetting& setting = getSnapshot()->get(KataGoLevel::EVAL);
+    query.max_visits = setting.max_visits;
+    query.root_policy_temperature = setting.temprature;
+    query.root_fpu_reduction_max = setting.fpu_red_max;
 }
 
-void KataGoSettings::applyEvaluationConfig (json& req) {
-    KataGoSetting setting = getSetting(KataGoLevel::EVAL);
-    req["maxVisits"] = setting.max_visits;
-    req["rootPolicyTemperature"] = setting.temprature;
-    req["rootFpuReductionMax"] = setting.fpu_red_max;
+#ifdef __linux__
+KataGoSettingsWatcher::KataGoSettingsWatcher (const std::string& path): path(path) {
+    std::filesystem::path directory = std::filesystem::path(path).parent_path();
+    if (directory.empty()) directory = ".";
+
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0 || inotify_add_watch(inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        SDL_Log("[KataGo settings] Could not watch %s, changes need a restart", directory.c_str());
+        return;
+    }
+
+    int wake[2];
+    if (pipe2(wake, O_CLOEXEC) != 0)
+        return;
+    wake_read_fd = wake[0];
+    wake_write_fd = wake[1];
+
+    thread = std::thread(&KataGoSettingsWatcher::watchLoop, this);
 }
 
+KataGoSettingsWatcher::~KataGoSettingsWatcher () {
+    if (wake_write_fd >= 0) {
+        char wake = 0;
+        write(wake_write_fd, &wake, 1);
+    }
+
+    if (thread.joinable())
+        thread.join();
+
+    for (int fd : {inotify_fd, wake_read_fd, wake_write_fd}) {
+        if (fd >= 0) close(fd);
+    }
+}
+
+void KataGoSettingsWatcher::watchLoop () {
+    std::string file_name = std::filesystem::path(path).filename().string();
+    pollfd fds[2] = {
+        {inotify_fd, POLLIN, 0},
+        {wake_read_fd, POLLIN, 0}
+    };
+
+    alignas(inotify_event) char buffer[4096];
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        if (fds[1].revents)
+            return;
+
+        ssize_t n = read(inotify_fd, buffer, sizeof(buffer));
+        if (n <= 0)
+            continue;
+
+        // Other files of the directory change too
+        bool is_changed = false;
+        for (char* it = buffer; it < buffer + n;) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(it);
+            if (event->len > 0 && file_name == event->name) {
+                is_changed = true;
+            }
+            it += sizeof(inotify_event) + event->len;
+        }
+
+        if (is_changed && KataGoSettings::load(path)) {
+            SDL_Log("[KataGo settings] Reloaded %s", path.c_str());
+        }
+    }
+}
+#else
+static std::filesystem::file_time_type getWriteTime (const std::string& path) {
+    std::error_code error;
+    std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+    return error ? std::filesystem::file_time_type::min() : time;
+}
+
+KataGoSettingsWatcher::KataGoSettingsWatcher (const std::string& path): path(path) {
+    thread = std::thread(&KataGoSettingsWatcher::watchLoop, this);
+}
+
+KataGoSettingsWatcher::~KataGoSettingsWatcher () {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        is_stopping = true;
+    }
+    stopped.notify_all();
+
+    if (thread.joinable())
+        thread.join();
+}
+
+void KataGoSettingsWatcher::watchLoop () {
+    std::filesystem::file_time_type last_write = getWriteTime(path);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopped.wait_for(lock, std::chrono::seconds(KATAGO_SETTINGS_POLL_SECONDS), [&] { return is_stopping; })) {
+        std::filesystem::file_time_type write_time = getWriteTime(path);
+        if (write_time == last_write)
+            continue;
+
+        last_write = write_time;
+        if (KataGoSettings::load(path)) {
+            SDL_Log("[KataGo settings] Reloaded %s", path.c_str());
+        }
+    }
+}
+#endif
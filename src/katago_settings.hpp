@@ -2,6 +2,16 @@
 #define GO_KATAGO_SETTINGS_H
 
 #include "json.hpp"
+#include "katago_query.hpp"
+#include <array>
+#include <memory>
+#include <string>
+#include <thread>
+
+#ifndef __linux__
+#include <condition_variable>
+#include <mutex>
+#endif
 
 using nlohmann::json;
 
@@ -53,12 +63,38 @@ typedef struct {
     float fpu_red_max;
 } KataGoSetting;
 
+#define KATAGO_SETTINGS_PATH "./assets/KataGo/config/settings.json"
+
+// Seconds between checks of the settings file where it cannot be watched
+#define KATAGO_SETTINGS_POLL_SECONDS 1
+
+// Every level as read from the settings file at one point in time. Never
+// changed once loaded, a reload swaps in a new one, so a query reads one
+// consistent set without a lock.
+struct KataGoSettingsSnapshot {
+    std::array<KataGoSetting, 6> settings; // by KataGoLevel
+
+    const KataGoSetting& get (KataGoLevel level) const {
+        return settings[static_cast<int>(level)];
+    }
+};
+
 class KataGoSettings {
-    static KataGoSetting getSetting (KataGoLevel level);
+    static std::shared_ptr<const KataGoSettingsSnapshot> snapshot;
 
 public:
-    static void applyDiffLevel (json& req, KataGoLevel level);
-    static void applyEvaluationConfig (json& req);
+    // Reads the settings file into a new snapshot, the only disk I/O of the
+    // settings. A missing file gives the defaults. A file that does not
+    // parse gives the defaults at first, on a reload it keeps the settings
+    // in use, as it is most likely still being saved. False when the file
+    // could not be used.
+    static bool load (const std::string& path = KATAGO_SETTINGS_PATH);
+
+    // Loads the settings the first time
+    static std::shared_ptr<const KataGoSettingsSnapshot> getSnapshot ();
+
+    static void applyDiffLevel (KataGoQuery& query, KataGoLevel level);
+    static void applyEvaluationConfig (KataGoQuery& query);
 
     // Prevent instantiation
     KataGoSettings() = delete;
@@ -66,4 +102,35 @@ public:
     KataGoSettings& operator=(const KataGoSettings&) = delete;
 };
 
+// Loads the settings again whenever their file changes, so levels can be
+// tuned while playing. On Linux inotify watches the directory, which also
+// catches editors that save by renaming a new file over the old one.
+// Elsewhere the modification time is checked every
+// KATAGO_SETTINGS_POLL_SECONDS.
+class KataGoSettingsWatcher {
+    std::string path;
+    std::thread thread;
+
+#ifdef __linux__
+    int inotify_fd = -1;
+
+    // Self-pipe, the destructor writes a byte to stop the watch
+    int wake_read_fd = -1;
+    int wake_write_fd = -1;
+#else
+    std::mutex mutex;
+    std::condition_variable stopped;
+    bool is_stopping = false;
+#endif
+
+    void watchLoop ();
+
+public:
+    KataGoSettingsWatcher (const std::string& path = KATAGO_SETTINGS_PATH);
+    ~KataGoSettingsWatcher ();
+
+    KataGoSettingsWatcher(const KataGoSettingsWatcher&) = delete;
+    KataGoSettingsWatcher& operator=(const KataGoSettingsWatcher&) = delete;
+};
+
 #endif
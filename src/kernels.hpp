@@ -0,0 +1,40 @@
+#ifndef GO_KERNELS_H
+#define GO_KERNELS_H
+
+#include "base.hpp"
+#include "position.hpp"
+
+// Geometry the group table and rule kernels of a board are compiled against.
+// Picked once when a GoBoardStateComputed is created.
+enum class GoBoardKernels {
+    GENERIC,    // reads the geometry from the GoBoardPosition at runtime
+    SIZE_9x9,
+    SIZE_13x13,
+    SIZE_19x19
+};
+
+// Specialised kernels for 9x9, 13x13 and 19x19, the generic ones otherwise
+inline GoBoardKernels getBoardKernels (int size) {
+    switch (static_cast<GoBoardSize>(size)) {
+        case GoBoardSize::_9x9: return GoBoardKernels::SIZE_9x9;
+        case GoBoardSize::_13x13: return GoBoardKernels::SIZE_13x13;
+        case GoBoardSize::_19x19: return GoBoardKernels::SIZE_19x19;
+        default: return GoBoardKernels::GENERIC;
+    }
+}
+
+inline GoBoardKernels getGenericBoardKernels () { return GoBoardKernels::GENERIC; }
+
+// Calls fn with the geometry the kernels are compiled against, GO_POSITION<N>
+// or the board itself, so the templated kernels are called directly
+template <typename Fn>
+inline decltype(auto) withBoardGeometry (GoBoardKernels kernels, const GoBoardPosition& board, Fn&& fn) {
+    switch (kernels) {
+        case GoBoardKernels::SIZE_9x9: return fn(GO_POSITION<9>);
+        case GoBoardKernels::SIZE_13x13: return fn(GO_POSITION<13>);
+        case GoBoardKernels::SIZE_19x19: return fn(GO_POSITION<19>);
+        default: return fn(board);
+    }
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "base.hpp"
+#include "bench.hpp"
 #include "board.hpp"
 #include <SDL3/SDL_blendmode.h>
 #include <SDL3/SDL_events.h>
@@ -23,6 +24,15 @@ int main(int argc, char **argv) {
         return -1;
     }
 
+    if (argc > 1 && std::string(argv[1]) == "--test") {
+        return isSystemTestPassed() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        runBenchmarks();
+        return EXIT_SUCCESS;
+    }
+
     GoGameConfig::init("./config.json");
     GoErrorHandler::init();
     GoThemeHandler::init();
@@ -89,7 +99,18 @@ int main(int argc, char **argv) {
 
     int w, h;
     SDL_GetWindowSize(window, &w, &h);
-    GoBoard* board = new GoBoard(renderer, w, h, GoBoardSize::_9x9);
+    // Started once, switching the board size keeps the model loaded
+    auto katago_service = std::make_shared<KataGoService>(
+        !GoGameConfig::isEngineEnabled(),
+        GoGameConfig::getKatagoPath(),
+        GoGameConfig::getKatagoConfigPath(),
+        GoGameConfig::getModelPath(),
+        GoGameConfig::getAnalysisCachePath(),
+        static_cast<size_t>(GoGameConfig::getAnalysisCacheMaxMB()) << 20,
+        GoGameConfig::getKatagoProcesses()
+    );
+
+    GoBoard* board = new GoBoard(renderer, w, h, GoBoardSize::_9x9, katago_service);
     board->setupTextEngine(text_engine, font);
 
     while (isRunning) {
@@ -113,17 +134,17 @@ int main(int argc, char **argv) {
                 if (key_event.mod & SDL_KMOD_SHIFT) {
                     if (key_event.scancode == SDL_SCANCODE_1) {
                         delete board;
-                        board = new GoBoard(renderer, w, h, GoBoardSize::_9x9);
+                        board = new GoBoard(renderer, w, h, GoBoardSize::_9x9, katago_service);
                         board->setupTextEngine(text_engine, font);
                         is_reset = true;
                     } else if (key_event.scancode == SDL_SCANCODE_2) {
                         delete board;
-                        board = new GoBoard(renderer, w, h, GoBoardSize::_13x13);
+                        board = new GoBoard(renderer, w, h, GoBoardSize::_13x13, katago_service);
                         board->setupTextEngine(text_engine, font);
                         is_reset = true;
                     } else if (key_event.scancode == SDL_SCANCODE_3) {
                         delete board;
-                        board = new GoBoard(renderer, w, h, GoBoardSize::_19x19);
+                        board = new GoBoard(renderer, w, h, GoBoardSize::_19x19, katago_service);
                         board->setupTextEngine(text_engine, font);
                         is_reset = true;
                     }
@@ -167,6 +188,7 @@ int main(int argc, char **argv) {
         SDL_Delay(16); // ~60 FPS
     }
 
+    delete board;
     GoSound::destroy();
 
     SDL_DestroyRenderer(renderer);
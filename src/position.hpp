@@ -0,0 +1,275 @@
+#ifndef GO_POSITION_H
+#define GO_POSITION_H
+
+#include "base.hpp"
+#include "zobrist.hpp"
+#include <array>
+#include <cstdint>
+
+#define GO_MAX_BOARD_DIM 19
+#define GO_MAX_PADDED_DIM (GO_MAX_BOARD_DIM + 2)
+#define GO_MAX_POINTS (GO_MAX_PADDED_DIM * GO_MAX_PADDED_DIM)
+
+// 19x19 = 361 points fit in 6 words
+#define GO_BITBOARD_WORDS 6
+
+enum class GoBoardCellState: uint8_t {
+    EMPTY = 0,
+    BLACK = 1,
+    WHITE = 2,
+
+    // Padding ring around the board, never returned for an on-board cell
+    OFFBOARD = 3
+};
+
+inline int getTurnIndex (GoTurn turn) {
+    return turn == GoTurn::BLACK ? 0 : 1;
+}
+
+inline GoBoardCellState getCellStateFromTurn (GoTurn turn) {
+    return turn == GoTurn::BLACK ?
+        GoBoardCellState::BLACK :
+        GoBoardCellState::WHITE;
+}
+
+// One bit per on-board cell, indexed by (x * size + y)
+struct GoBitboard {
+    std::array<uint64_t, GO_BITBOARD_WORDS> words = {};
+
+    constexpr bool test (int index) const { return (words[index >> 6] >> (index & 63)) & 1; }
+    constexpr void set (int index) { words[index >> 6] |= (uint64_t(1) << (index & 63)); }
+    constexpr void reset (int index) { words[index >> 6] &= ~(uint64_t(1) << (index & 63)); }
+    void clear () { words.fill(0); }
+
+    // The first n indexes set, e.g. every cell of an n point board
+    static constexpr GoBitboard firstN (int n) {
+        GoBitboard result;
+        for (int i = 0; i < GO_BITBOARD_WORDS; i++) {
+            int bits = n - i * 64;
+            result.words[i] = bits >= 64 ? ~uint64_t(0) : bits > 0 ? (uint64_t(1) << bits) - 1 : 0;
+        }
+        return result;
+    }
+
+    int count () const {
+        int total = 0;
+        for (uint64_t word : words) total += __builtin_popcountll(word);
+        return total;
+    }
+
+    bool any () const {
+        for (uint64_t word : words) if (word) return true;
+        return false;
+    }
+
+    GoBitboard& operator|= (const GoBitboard& other) {
+        for (int i = 0; i < GO_BITBOARD_WORDS; i++) words[i] |= other.words[i];
+        return *this;
+    }
+
+    GoBitboard& operator&= (const GoBitboard& other) {
+        for (int i = 0; i < GO_BITBOARD_WORDS; i++) words[i] &= other.words[i];
+        return *this;
+    }
+
+    constexpr GoBitboard operator| (const GoBitboard& other) const {
+        GoBitboard result;
+        for (int i = 0; i < GO_BITBOARD_WORDS; i++) result.words[i] = words[i] | other.words[i];
+        return result;
+    }
+
+    constexpr GoBitboard operator& (const GoBitboard& other) const {
+        GoBitboard result;
+        for (int i = 0; i < GO_BITBOARD_WORDS; i++) result.words[i] = words[i] & other.words[i];
+        return result;
+    }
+
+    constexpr GoBitboard operator~ () const {
+        GoBitboard result;
+        for (int i = 0; i < GO_BITBOARD_WORDS; i++) result.words[i] = ~words[i];
+        return result;
+    }
+
+    // Moves every bit towards higher (shiftUp) or lower (shiftDown) indexes,
+    // 0 < shift < 64
+    constexpr GoBitboard shiftUp (int shift) const {
+        GoBitboard result;
+        for (int i = GO_BITBOARD_WORDS - 1; i >= 0; i--) {
+            result.words[i] = (words[i] << shift) | (i > 0 ? words[i-1] >> (64 - shift) : 0);
+        }
+        return result;
+    }
+
+    constexpr GoBitboard shiftDown (int shift) const {
+        GoBitboard result;
+        for (int i = 0; i < GO_BITBOARD_WORDS; i++) {
+            result.words[i] = (words[i] >> shift)
+                | (i + 1 < GO_BITBOARD_WORDS ? words[i+1] << (64 - shift) : 0);
+        }
+        return result;
+    }
+
+    bool operator== (const GoBitboard& other) const { return words == other.words; }
+    bool operator!= (const GoBitboard& other) const { return words != other.words; }
+
+    // Calls fn(index) for every set bit, lowest index first
+    template <typename Fn>
+    void forEach (Fn&& fn) const {
+        for (int i = 0; i < GO_BITBOARD_WORDS; i++) {
+            uint64_t word = words[i];
+            while (word) {
+                fn((i << 6) + __builtin_ctzll(word));
+                word &= word - 1;
+            }
+        }
+    }
+};
+
+template <int N>
+constexpr std::array<int16_t, (N + 2) * (N + 2)> genPointToIndex () {
+    std::array<int16_t, (N + 2) * (N + 2)> point_to_index = {};
+    for (int point = 0; point < static_cast<int>(point_to_index.size()); point++) {
+        int x = point / (N + 2) - 1, y = point % (N + 2) - 1;
+        point_to_index[point] = (x < 0 || y < 0 || x >= N || y >= N) ? -1 : x * N + y;
+    }
+    return point_to_index;
+}
+
+// Cells with no on-board neighbour in each direction (up, right, down, left)
+constexpr std::array<GoBitboard, 4> genEdgeMasks (int size) {
+    std::array<GoBitboard, 4> edges = {};
+    for (int i = 0; i < size; i++) {
+        edges[0].set(i * size);
+        edges[1].set((size - 1) * size + i);
+        edges[2].set(i * size + size - 1);
+        edges[3].set(i);
+    }
+    return edges;
+}
+
+// Every cell orthogonally adjacent to a cell of the mask
+constexpr GoBitboard getNeighbourCells (
+    const GoBitboard& mask,
+    const std::array<GoBitboard, 4>& edges,
+    int size
+) {
+    return (mask & ~edges[0]).shiftDown(1)
+        | (mask & ~edges[1]).shiftUp(size)
+        | (mask & ~edges[2]).shiftUp(1)
+        | (mask & ~edges[3]).shiftDown(size);
+}
+
+// Compile time geometry of an N x N board. It mirrors the coordinate helpers
+// of GoBoardPosition, so the group and rule kernels are written once against
+// either and the constexpr version lets the compiler fold the stride and
+// unroll the neighbour loops.
+template <int N>
+struct GoPosition {
+    static_assert(N > 0 && N <= GO_MAX_BOARD_DIM, "unsupported board size");
+
+    static constexpr int STRIDE = N + 2;
+    static constexpr std::array<int, 4> NEIGHBOURS = {-1, STRIDE, 1, -STRIDE};
+    static constexpr std::array<int16_t, STRIDE * STRIDE> POINT_TO_INDEX = genPointToIndex<N>();
+    static constexpr std::array<GoBitboard, 4> EDGES = genEdgeMasks(N);
+
+    static constexpr int getSize () { return N; }
+    static constexpr int getStride () { return STRIDE; }
+
+    static constexpr int toPoint (int x, int y) { return (x + 1) * STRIDE + (y + 1); }
+    static constexpr int toIndex (int x, int y) { return x * N + y; }
+    static constexpr int pointToIndex (int point) { return POINT_TO_INDEX[point]; }
+    static constexpr int indexToPoint (int index) { return toPoint(index / N, index % N); }
+    static constexpr int pointX (int point) { return point / STRIDE - 1; }
+    static constexpr int pointY (int point) { return point % STRIDE - 1; }
+
+    static constexpr std::array<int, 4> getNeighbourOffsets () { return NEIGHBOURS; }
+
+    static constexpr GoBitboard getNeighbours (const GoBitboard& mask) {
+        return getNeighbourCells(mask, EDGES, N);
+    }
+};
+
+template <int N>
+inline constexpr GoPosition<N> GO_POSITION = {};
+
+// Flat board with a one cell OFFBOARD ring, so neighbour lookups never need
+// bounds checks. A "point" is an index into the padded array, an "index" is
+// the unpadded (x * size + y) used by the bitboards.
+class GoBoardPosition {
+    int size;
+    int stride;
+
+    std::array<GoBoardCellState, GO_MAX_POINTS> cells;
+    std::array<GoBitboard, 2> stones;
+
+    // Edge masks of genEdgeMasks(size), built once for getNeighbours
+    std::array<GoBitboard, 4> edges;
+
+    // Zobrist hash of the stones, kept in sync by setAt
+    uint64_t hash = 0;
+
+public:
+    GoBoardPosition (int size): size(size), stride(size + 2), edges(genEdgeMasks(size)) {
+        cells.fill(GoBoardCellState::OFFBOARD);
+        for (int x = 0; x < size; x++) {
+            for (int y = 0; y < size; y++) {
+                cells[toPoint(x, y)] = GoBoardCellState::EMPTY;
+            }
+        }
+    }
+
+    bool operator== (const GoBoardPosition& other) const {
+        return size == other.size && hash == other.hash && stones == other.stones;
+    }
+
+    int getSize () const { return size; }
+    int getStride () const { return stride; }
+
+    int toPoint (int x, int y) const { return (x + 1) * stride + (y + 1); }
+    int toIndex (int x, int y) const { return x * size + y; }
+    int pointToIndex (int point) const { return (point / stride - 1) * size + (point % stride - 1); }
+    int indexToPoint (int index) const { return toPoint(index / size, index % size); }
+    int pointX (int point) const { return point / stride - 1; }
+    int pointY (int point) const { return point % stride - 1; }
+
+    // Point offsets matching DIRECTIONS in rules.hpp (up, right, down, left)
+    std::array<int, 4> getNeighbourOffsets () const { return {-1, stride, 1, -stride}; }
+
+    // Slow path of GoPosition<N>::getNeighbours for the generic kernels
+    GoBitboard getNeighbours (const GoBitboard& mask) const {
+        return getNeighbourCells(mask, edges, size);
+    }
+
+    GoBoardCellState get (int x, int y) const { return cells[toPoint(x, y)]; }
+    GoBoardCellState at (int point) const { return cells[point]; }
+
+    const GoBitboard& getStones (GoTurn turn) const { return stones[getTurnIndex(turn)]; }
+    GoBitboard getEmpty () const { return GoBitboard::firstN(size * size) & ~(stones[0] | stones[1]); }
+    uint64_t getHash () const { return hash; }
+
+    void set (int x, int y, GoBoardCellState cell_state) { setAt(toPoint(x, y), cell_state); }
+    void setAt (int point, GoBoardCellState cell_state) { setAt(point, pointToIndex(point), cell_state); }
+
+    // For kernels that already know the index of the point
+    void setAt (int point, int index, GoBoardCellState cell_state) {
+        GoBoardCellState prev = cells[point];
+        if (prev == GoBoardCellState::BLACK) {
+            stones[0].reset(index);
+            hash ^= getZobristStoneKey(GoTurn::BLACK, index);
+        } else if (prev == GoBoardCellState::WHITE) {
+            stones[1].reset(index);
+            hash ^= getZobristStoneKey(GoTurn::WHITE, index);
+        }
+
+        cells[point] = cell_state;
+        if (cell_state == GoBoardCellState::BLACK) {
+            stones[0].set(index);
+            hash ^= getZobristStoneKey(GoTurn::BLACK, index);
+        } else if (cell_state == GoBoardCellState::WHITE) {
+            stones[1].set(index);
+            hash ^= getZobristStoneKey(GoTurn::WHITE, index);
+        }
+    }
+};
+
+#endif
@@ -1,112 +1,85 @@
 #include "rules.hpp"
 #include "base.hpp"
 
-GoBoardRuleManager::GroupResult
-GoBoardRuleManager::exploreGroupAndLiberties(
-    std::vector<std::vector<bool>>& visited,
-    const GoBoardStateComputed& board,
-    GoTurn target, int sx, int sy
-) {
-    GroupResult result;
-    std::queue<std::pair<int,int>> q;
-
-    q.push({sx, sy});
-    visited[sx][sy] = true;
-
-    while (!q.empty()) {
-        auto [x, y] = q.front(); q.pop();
-        result.stones.push_back({target, x, y});
-
-        for (auto [dx, dy] : DIRECTIONS) {
-            int nx = x + dx, ny = y + dy;
-
-            if (nx < 0 || ny < 0 || nx >= board.getSize() || ny >= board.getSize())
-                continue;
-
-            if (visited[nx][ny]) continue;
-
-            GoBoardCellState cell = board.get(nx, ny);
-            auto turn = getTurnFromCellState(cell);
-
-            if (!turn.has_value()) {
-                result.has_liberty = true;  // found a liberty
-                continue;
-            }
-
-            if (turn.value() == target) {
-                visited[nx][ny] = true;
-                q.push({nx, ny});
-            }
-        }
-    }
+std::vector<std::vector<GoStone>>
+GoBoardRuleManager::getCapturedGroups(const GoBoardStateComputed& computed, GoStone placedStone)
+{
+    return withBoardGeometry(computed.getKernels(), computed.getPosition(), [&](const auto& geometry) {
+        return getCapturedGroups(computed, placedStone, geometry);
+    });
+}
 
-    return result;
+bool GoBoardRuleManager::isValidStoneIgnoringCapture(const GoBoardStateComputed& computed, GoStone stone)
+{
+    return withBoardGeometry(computed.getKernels(), computed.getPosition(), [&](const auto& geometry) {
+        return isValidStoneIgnoringCapture(computed, stone, geometry);
+    });
 }
 
+template <typename Geometry>
 std::vector<std::vector<GoStone>>
-GoBoardRuleManager::getCapturedGroups(const GoBoardStateComputed& board, GoStone placedStone)
-{
-    int N = board.getSize();
-    std::vector<std::vector<bool>> visited(N, std::vector<bool>(N, false));
+GoBoardRuleManager::getCapturedGroups(
+    const GoBoardStateComputed& computed,
+    GoStone placedStone,
+    const Geometry& geometry
+) {
+    const GoBoardPosition& board = computed.getPosition();
+    const GoGroupTable& groups = computed.getGroups();
     std::vector<std::vector<GoStone>> captured;
 
-    visited[placedStone.x][placedStone.y] = true;
-
-    for (auto [dx, dy] : DIRECTIONS) {
-        int nx = placedStone.x + dx;
-        int ny = placedStone.y + dy;
-
-        if (nx < 0 || ny < 0 || nx >= N || ny >= N) continue;
-        if (visited[nx][ny]) continue;
-
-        GoBoardCellState cell = board.get(nx, ny);
-        auto turn = getTurnFromCellState(cell);
-        if (!turn.has_value()) continue;
-
-        bool is_enemy = turn.value() != placedStone.turn;
-        if (!is_enemy) continue;
-
-        auto group =
-            exploreGroupAndLiberties(
-                visited, board,
-                placedStone.turn == GoTurn::WHITE ?
-                    GoTurn::BLACK :
-                    GoTurn::WHITE,
-                nx, ny
-            );
-        if (!group.has_liberty) {
-            captured.push_back(group.stones);
+    GoTurn enemy = placedStone.turn == GoTurn::WHITE ?
+        GoTurn::BLACK :
+        GoTurn::WHITE;
+    GoBoardCellState enemy_state = getCellStateFromTurn(enemy);
+
+    int placed_point = geometry.toPoint(placedStone.x, placedStone.y);
+    std::array<int, 4> seen_roots = {GO_NO_GROUP, GO_NO_GROUP, GO_NO_GROUP, GO_NO_GROUP};
+
+    const std::array<int, 4> offsets = geometry.getNeighbourOffsets();
+    for (int i = 0; i < 4; i++) {
+        int next = placed_point + offsets[i];
+        if (board.at(next) != enemy_state) continue;
+
+        int root = groups.getGroup(next);
+        if (std::find(seen_roots.begin(), seen_roots.end(), root) != seen_roots.end()) continue;
+        seen_roots[i] = root;
+
+        // The placed point is adjacent, so it must be the last liberty
+        if (groups.getLibertyCount(root) == 1) {
+            std::vector<GoStone> stones;
+            stones.reserve(groups.getStoneCount(root));
+            groups.forEachStone(root, [&](int point) {
+                stones.push_back({enemy, geometry.pointX(point), geometry.pointY(point)});
+            });
+            captured.push_back(stones);
         }
     }
 
     return captured;
 }
 
-bool GoBoardRuleManager::isValidStoneIgnoringCapture(const GoBoardStateComputed& board, GoStone stone)
-{
-    int x = stone.x, y = stone.y;
-    int N = board.getSize();
-    std::vector<std::vector<bool>> visited(N, std::vector<bool>(N, false));
-
-    // Check immediate liberties
-    for (auto [dx, dy] : DIRECTIONS) {
-        int nx = x + dx, ny = y + dy;
-
-        if (nx < 0 || ny < 0 || nx >= N || ny >= N) continue;
+template <typename Geometry>
+bool GoBoardRuleManager::isValidStoneIgnoringCapture(
+    const GoBoardStateComputed& computed,
+    GoStone stone,
+    const Geometry& geometry
+) {
+    const GoBoardPosition& board = computed.getPosition();
+    const GoGroupTable& groups = computed.getGroups();
+    GoBoardCellState own_state = getCellStateFromTurn(stone.turn);
+    int point = geometry.toPoint(stone.x, stone.y);
 
-        GoBoardCellState cell = board.get(nx, ny);
-        auto turn = getTurnFromCellState(cell);
+    for (int offset : geometry.getNeighbourOffsets()) {
+        GoBoardCellState cell = board.at(point + offset);
 
-        if (!turn.has_value())
+        if (cell == GoBoardCellState::EMPTY)
             return true; // direct liberty
 
+        // Joining a friendly group that keeps a liberty other than this point
+        if (cell == own_state && groups.getLibertyCount(groups.getGroup(point + offset)) > 1)
+            return true;
     }
 
-    // Check if our own group has liberties
-    auto group = exploreGroupAndLiberties(visited, board, stone.turn, x, y);
-    if (group.has_liberty)
-        return true;
-
     return false;
 }
 
@@ -120,3 +93,20 @@ bool GoBoardRuleManager::isValidStone(const GoBoardStateComputed& board, GoStone
 
     return true;
 }
+
+bool GoBoardRuleManager::isInAtari(const GoBoardStateComputed& computed, int x, int y)
+{
+    const GoBoardPosition& board = computed.getPosition();
+    return computed.getGroups().isInAtari(board.toPoint(x, y));
+}
+
+#define GO_INSTANTIATE_RULE_KERNELS(Geometry) \
+    template std::vector<std::vector<GoStone>> GoBoardRuleManager::getCapturedGroups<Geometry>( \
+        const GoBoardStateComputed&, GoStone, const Geometry&); \
+    template bool GoBoardRuleManager::isValidStoneIgnoringCapture<Geometry>( \
+        const GoBoardStateComputed&, GoStone, const Geometry&);
+
+GO_INSTANTIATE_RULE_KERNELS(GoPosition<9>)
+GO_INSTANTIATE_RULE_KERNELS(GoPosition<13>)
+GO_INSTANTIATE_RULE_KERNELS(GoPosition<19>)
+GO_INSTANTIATE_RULE_KERNELS(GoBoardPosition)
@@ -3,8 +3,8 @@
 
 #include "base.hpp"
 #include "state.hpp"
+#include <algorithm>
 #include <optional>
-#include <queue>
 
 #define DIRECTION_UP 0
 #define DIRECTION_RIGHT 1
@@ -13,19 +13,9 @@
 
 const std::vector<std::pair<int, int>> DIRECTIONS = {{0,-1}, {1,0}, {0,1}, {-1,0}};
 
+// All checks read the incrementally maintained GoGroupTable of the computed
+// state, so none of them flood fill the board.
 class GoBoardRuleManager {
-private:
-    struct GroupResult {
-        std::vector<GoStone> stones;  // all stones in the group
-        bool has_liberty = false;     // at least one adjacent empty
-    };
-
-    static GroupResult exploreGroupAndLiberties(
-        std::vector<std::vector<bool>>& visited,
-        const GoBoardStateComputed& board,
-        GoTurn target, int sx, int sy
-    );
-
 public:
     static std::vector<std::vector<GoStone>>
     getCapturedGroups(const GoBoardStateComputed& board, GoStone placedStone);
@@ -33,6 +23,18 @@ public:
     static bool isValidStoneIgnoringCapture(const GoBoardStateComputed& board, GoStone stone);
     static bool isValidStone(const GoBoardStateComputed& board, GoStone stone);
 
+    // True if the group containing the stone at (x, y) has a single liberty
+    static bool isInAtari(const GoBoardStateComputed& board, int x, int y);
+
+    // Size specialised bodies of the checks above, reached through the
+    // GoBoardKernels of the board, see kernels.hpp. Instantiated in rules.cpp.
+    template <typename Geometry>
+    static std::vector<std::vector<GoStone>>
+    getCapturedGroups(const GoBoardStateComputed& board, GoStone placedStone, const Geometry& geometry);
+
+    template <typename Geometry>
+    static bool isValidStoneIgnoringCapture(const GoBoardStateComputed& board, GoStone stone, const Geometry& geometry);
+
     // Prevent instantiation
     GoBoardRuleManager() = delete;
     GoBoardRuleManager(const GoBoardRuleManager&) = delete;
@@ -1,45 +1,270 @@
 #include "state.hpp"
 #include "actions.hpp"
 #include "base.hpp"
-#include "compute.hpp"
 #include "error.hpp"
 #include "rules.hpp"
 #include "sound.hpp"
+#include <algorithm>
+#include <cstdlib>
 #include <optional>
 #include <iostream>
-#include <variant>
 
-void GoBoardState::handleUndoClear () {
-    if (undo_by > 0 && actions.size() >= undo_by) {
-        actions.resize(actions.size()-undo_by);
+std::optional<GoErrorEnum> GoBoardStateComputed::apply (const GoGameTree& tree, const GoGameNode& node) {
+    if (isPackedPass(node.move)) {
+        GoTurn turn = getPackedTurn(node.move);
+        if (in_pass.has_value()) {
+            if (in_pass.value() != turn) {
+                is_ended = true;
+            }
+        } else {
+            in_pass = std::make_optional<GoTurn>(turn);
+        }
+        return std::nullopt;
     }
-    undo_by = 0;
+
+    GoStone stone = unpackStone(getSize(), node.move);
+    if (get(stone.x, stone.y) != GoBoardCellState::EMPTY) {
+        return std::make_optional<GoErrorEnum>(GoErrorEnum::BOARD_STATE_CORRUPT);
+    }
+
+    GoBoardCellState enemy_state = getCellStateFromTurn(getOppositeTurn(stone.turn));
+    std::vector<int> points;
+    points.reserve(node.captured_count);
+    bool is_corrupt = false;
+    tree.forEachCaptured(node, [&](int index) {
+        int point = position.indexToPoint(index);
+        is_corrupt |= position.at(point) != enemy_state;
+        points.push_back(point);
+    });
+    if (is_corrupt) {
+        return std::make_optional<GoErrorEnum>(GoErrorEnum::BOARD_STATE_CORRUPT);
+    }
+
+    int point = position.toPoint(stone.x, stone.y);
+    withBoardGeometry(kernels, position, [&](const auto& geometry) {
+        groups.place(position, geometry, point, stone.turn);
+        if (!points.empty()) {
+            groups.remove(position, geometry, points);
+        }
+    });
+    in_pass = std::nullopt;
+
+    return std::nullopt;
+}
+
+void GoBoardStateComputed::unapply (const GoGameTree& tree, const GoGameNode& node, std::optional<GoTurn> prev_in_pass) {
+    if (!isPackedPass(node.move)) {
+        GoStone stone = unpackStone(getSize(), node.move);
+        GoTurn enemy = getOppositeTurn(stone.turn);
+        withBoardGeometry(kernels, position, [&](const auto& geometry) {
+            groups.remove(position, geometry, {position.toPoint(stone.x, stone.y)});
+            tree.forEachCaptured(node, [&](int index) {
+                groups.place(position, geometry, position.indexToPoint(index), enemy);
+            });
+        });
+    }
+
+    // Nothing can be played after the game ends, so the state before any
+    // move was still running
+    in_pass = prev_in_pass;
+    is_ended = false;
+}
+
+GoPositionHash GoBoardStateComputed::getHashAfter (
+    const GoStone& stone,
+    const std::vector<GoStone>& removed_stones
+) const {
+    uint64_t next_position = position.getHash()
+        ^ getZobristStoneKey(stone.turn, position.toIndex(stone.x, stone.y));
+    for (const GoStone& removed : removed_stones) {
+        next_position ^= getZobristStoneKey(removed.turn, position.toIndex(removed.x, removed.y));
+    }
+
+    return getPositionHash(next_position, getOppositeTurn(stone.turn));
+}
+
+std::optional<GoTurn> GoBoardState::getPassStateBefore (int move_number) const {
+    // The first pass of the run of passes leading up to the move
+    std::optional<GoTurn> in_pass = std::nullopt;
+    for (int i = move_number - 1; i >= 1 && isPackedPass(line[i]->move); i--) {
+        in_pass = std::make_optional<GoTurn>(getPackedTurn(line[i]->move));
+    }
+    return in_pass;
 }
 
 void GoBoardState::clear () {
-    actions.clear();
     undo_by = 0;
 
     this->computed = GoBoardStateComputed(static_cast<int>(dim));
+    invalidateLegalMoves();
+
+    this->tree = GoGameTree(getPositionHash(this->computed.getPosition().getHash(), GoTurn::BLACK));
+    line.clear();
+    first_seen_positions.clear();
+    first_seen_situations.clear();
+    pushLine(tree.getRoot());
+
+    checkpoints.clear();
+    checkpoints.push_back(this->computed.getCheckpoint());
+}
+
+void GoBoardState::pushLine (const GoGameLine& node) {
+    int index = line.size();
+    line.push_back(node);
+
+    // emplace keeps an earlier occurrence
+    first_seen_positions.emplace(node->hash.position, index);
+    first_seen_situations.emplace(node->hash.situation, index);
+}
+
+void GoBoardState::truncateLine (int size) {
+    for (int i = line.size() - 1; i >= size; i--) {
+        auto position_it = first_seen_positions.find(line[i]->hash.position);
+        if (position_it != first_seen_positions.end() && position_it->second == i)
+            first_seen_positions.erase(position_it);
+
+        auto situation_it = first_seen_situations.find(line[i]->hash.situation);
+        if (situation_it != first_seen_situations.end() && situation_it->second == i)
+            first_seen_situations.erase(situation_it);
+    }
+    line.resize(size);
+
+    int checkpoint_count = (size - 1) / checkpoint_interval + 1;
+    if (checkpoints.size() > checkpoint_count) {
+        checkpoints.erase(checkpoints.begin() + checkpoint_count, checkpoints.end());
+    }
+}
+
+void GoBoardState::extendLine () {
+    // Follow the first variation played from the tip, so redo walks back
+    // into a line that was explored before
+    for (;;) {
+        const std::vector<GoGameLine>& children = tree.getChildren(line.back().get());
+        if (children.empty()) break;
+
+        pushLine(children.front());
+        undo_by++;
+    }
+}
+
+Result<bool, GoErrorEnum> GoBoardState::playNode (const GoGameLine& node) {
+    int current = getMoveNumber();
+
+    // Replaying the move that redo would play keeps the rest of the line
+    if (undo_by == 0 || line[current+1] != node) {
+        truncateLine(current + 1);
+        pushLine(node);
+        undo_by = 0;
+        extendLine();
+    } else {
+        undo_by--;
+    }
+    invalidateLegalMoves();
+
+    std::optional<GoErrorEnum> err = this->computed.apply(tree, *node);
+    if (err.has_value())
+        return Err(err.value());
+
+    pushCheckpointIfDue();
+    return Ok(true);
+}
+
+bool GoBoardState::isRepeatedPosition (const GoPositionHash& next) const {
+    int current = getMoveNumber();
+
+    switch (ko_rule) {
+        case GoKoRule::POSITIONAL_SUPERKO: {
+            auto it = first_seen_positions.find(next.position);
+            return it != first_seen_positions.end() && it->second <= current;
+        }
+        case GoKoRule::SITUATIONAL_SUPERKO: {
+            auto it = first_seen_situations.find(next.situation);
+            return it != first_seen_situations.end() && it->second <= current;
+        }
+        default:
+        case GoKoRule::SIMPLE_KO:
+            // The position before the opponent's last move
+            return current >= 1 && line[current-1]->hash.position == next.position;
+    }
+}
+
+void GoBoardState::pushCheckpointIfDue () {
+    int move_number = getMoveNumber();
+    if (move_number % checkpoint_interval != 0
+            || checkpoints.size() != move_number / checkpoint_interval)
+        return;
+
+    checkpoints.push_back(this->computed.getCheckpoint());
+}
+
+void GoBoardState::setCheckpointInterval (int checkpoint_interval) {
+    if (checkpoint_interval < 1 || checkpoint_interval == this->checkpoint_interval)
+        return;
+
+    this->checkpoint_interval = checkpoint_interval;
+
+    GoBoardStateComputed replay(static_cast<int>(dim));
+    checkpoints.erase(checkpoints.begin() + 1, checkpoints.end());
+    for (int move_number = 1; move_number < line.size(); move_number++) {
+        replay.apply(tree, *line[move_number]);
+
+        if (move_number % checkpoint_interval == 0) {
+            checkpoints.push_back(replay.getCheckpoint());
+        }
+    }
+}
+
+Result<bool, GoErrorEnum> GoBoardState::seek (int move_number) {
+    if (move_number < 0 || move_number > getMoveCount())
+        return Ok(false);
+
+    int current = getMoveNumber();
+    if (move_number == current)
+        return Ok(false);
+
+    invalidateLegalMoves();
+
+    int checkpoint_index = std::min<int>(move_number / checkpoint_interval, checkpoints.size() - 1);
+    int checkpoint_move = checkpoint_index * checkpoint_interval;
+
+    if (move_number - checkpoint_move < std::abs(move_number - current)) {
+        this->computed.restore(checkpoints[checkpoint_index]);
+        current = checkpoint_move;
+    }
+
+    while (current > move_number) {
+        this->computed.unapply(tree, *line[current], getPassStateBefore(current));
+        current--;
+    }
+
+    while (current < move_number) {
+        std::optional<GoErrorEnum> err = this->computed.apply(tree, *line[current+1]);
+        if (err.has_value()) {
+            undo_by = getMoveCount() - current;
+            return Err(err.value());
+        }
+        current++;
+
+        undo_by = getMoveCount() - current;
+        pushCheckpointIfDue();
+    }
+
+    undo_by = getMoveCount() - move_number;
+    return Ok(true);
 }
 
 Result<bool, GoErrorEnum> GoBoardState::redo () {
     if (undo_by-1 >= 0) {
         undo_by--;
+        invalidateLegalMoves();
+        int current = getMoveNumber();
 
-        Result<GoBoardStateComputed, GoErrorEnum> res =
-            computeActions(
-                this->dim,
-                std::vector(
-                    this->actions.begin(),
-                    this->actions.end() - undo_by
-                )
-            );
-        if (res.is_err()) {
-            return Err(res.err_value());
+        std::optional<GoErrorEnum> err = this->computed.apply(tree, *line[current]);
+        if (err.has_value()) {
+            return Err(err.value());
         }
 
-        this->computed = res.ok_value();
+        pushCheckpointIfDue();
         return Ok(true);
     }
 
@@ -47,68 +272,53 @@ Result<bool, GoErrorEnum> GoBoardState::redo () {
 }
 
 Result<bool, GoErrorEnum> GoBoardState::undo () {
-    if (static_cast<long>(actions.size()) - (undo_by+1) >= 0) {
+    if (getMoveNumber() > 0) {
+        int current = getMoveNumber();
         undo_by++;
+        invalidateLegalMoves();
 
-        Result<GoBoardStateComputed, GoErrorEnum> res =
-            computeActions(
-                this->dim,
-                std::vector(
-                    this->actions.begin(),
-                    this->actions.end() - undo_by
-                )
-            );
-        if (res.is_err()) {
-            return Err(res.err_value());
-        }
-
-        this->computed = res.ok_value();
+        this->computed.unapply(tree, *line[current], getPassStateBefore(current));
         return Ok(true);
     }
 
     return Ok(false);
 }
 
+int GoBoardState::getVariationIndex () const {
+    int current = getMoveNumber();
+    if (undo_by == 0) return -1;
+
+    const std::vector<GoGameLine>& children = tree.getChildren(line[current].get());
+    for (int i = 0; i < children.size(); i++) {
+        if (children[i] == line[current+1]) return i;
+    }
+    return -1;
+}
+
+bool GoBoardState::switchVariation (int offset) {
+    int count = getVariationCount();
+    if (count < 2) return false;
+
+    int current = getMoveNumber();
+    int index = (getVariationIndex() + offset % count + count) % count;
+
+    truncateLine(current + 1);
+    pushLine(tree.getChildren(line[current].get())[index]);
+    undo_by = 1;
+    extendLine();
+    return true;
+}
+
 Result<bool, GoErrorEnum> GoBoardState::pass (GoTurn turn) {
     if (this->computed.isGameEnded())
         return Ok(false);
 
-    std::optional<GoTurn> prev_turn = std::nullopt;
-
-    if (actions.size() > 0) {
-        auto action = actions[actions.size()-undo_by-1];
-        prev_turn =
-            std::visit([&](auto&& action) -> std::optional<GoTurn> {
-                using T = std::decay_t<decltype(action)>;
-
-                if constexpr (std::is_same_v<T, PassAction>) {
-                    GoTurn turn = action.turn;
-                    return std::make_optional<GoTurn>(turn);
-                }
-
-                return std::nullopt;
-            }, action);
-    }
-
-    if (!prev_turn.has_value() || (prev_turn.has_value() && prev_turn.value() != turn)) {
-        actions.push_back(PassAction({turn}));
-        Result<GoBoardStateComputed, GoErrorEnum> res =
-            computeActions(
-                this->dim,
-                std::vector(
-                    this->actions.begin(),
-                    this->actions.end() - undo_by
-                )
-            );
-        if (res.is_err())
-            return Err(res.err_value());
-
-        this->computed = res.ok_value();
-        return Ok(true);
-    }
-
+    const GoGameNode& node = *line[getMoveNumber()];
+    if (!node.isRoot() && isPackedPass(node.move) && getPackedTurn(node.move) == turn)
+        return Ok(false);
 
-    return Ok(false);
+    GoPositionHash hash = getPositionHash(this->computed.getPosition().getHash(), getOppositeTurn(turn));
+    return playNode(tree.addChild(line[getMoveNumber()], packPass(turn), hash, {}));
 }
 
 Result<bool, GoErrorEnum> GoBoardState::addStone (GoStone stone) {
@@ -120,81 +330,121 @@ Result<bool, GoErrorEnum> GoBoardState::addStone (GoStone stone) {
         return Ok(false);
     }
 
-    bool is_stone_added = false;
-    std::vector<std::vector<GoStone>> captured_groups =
-        GoBoardRuleManager::getCapturedGroups(this->computed, stone);
-
-    if (captured_groups.size() > 0) {
-        std::vector<GoStone> removed_stones;
-        for (auto group : captured_groups) {
-            removed_stones.insert(removed_stones.end(), group.begin(), group.end());
+    std::vector<GoStone> removed_stones;
+    for (auto group : GoBoardRuleManager::getCapturedGroups(this->computed, stone)) {
+        removed_stones.insert(removed_stones.end(), group.begin(), group.end());
+    }
+    GoPositionHash next_hash = this->computed.getHashAfter(stone, removed_stones);
+
+    // The hover preview has usually filled the mask already, otherwise
+    // checking the one point is cheaper than building it
+    const std::optional<GoBitboard>& legal = legal_moves[getTurnIndex(stone.turn)];
+    if (!legal.has_value() || !legal->test(this->computed.getPosition().toIndex(stone.x, stone.y))) {
+        if (removed_stones.empty()
+                && !GoBoardRuleManager::isValidStoneIgnoringCapture(this->computed, stone)) {
+            return Ok(false);
         }
 
-        bool is_in_ko = computeIfKo(
-                this->dim,
-                std::vector(
-                    this->actions.begin(),
-                    this->actions.end() - undo_by
-                ),
-                CaptureStonesAction({stone, removed_stones})
-            );
-
-        if (!is_in_ko) {
-            GoSound::playCapture();
-            this->handleUndoClear();
-
-            actions.push_back(
-                CaptureStonesAction({
-                    stone, removed_stones
-                })
-            );
-            is_stone_added = true;
-        } else {
+        if (isRepeatedPosition(next_hash)) {
             GoErrorHandler::throwError(GoErrorEnum::GAME_IN_KO);
+            return Ok(false);
         }
-    } else if (GoBoardRuleManager::isValidStoneIgnoringCapture(this->computed, stone)) {
-        this->handleUndoClear();
-        actions.push_back(
-            AddStoneAction({stone})
-        );
-        is_stone_added = true;
-    }
-
-    if (is_stone_added) {
-        Result<GoBoardStateComputed, GoErrorEnum> res =
-            computeActions(
-                this->dim,
-                std::vector(
-                    this->actions.begin(),
-                    this->actions.end() - undo_by
-                )
-            );
-        if (res.is_err()) {
-            return Err(res.err_value());
-        }
+    }
+
+    const GoBoardPosition& position = this->computed.getPosition();
+    std::vector<uint16_t> captured;
+    captured.reserve(removed_stones.size());
+    for (const GoStone& removed : removed_stones) {
+        captured.push_back(position.toIndex(removed.x, removed.y));
+    }
 
-        this->computed = res.ok_value();
+    if (removed_stones.size() > 0) {
+        GoSound::playCapture();
     }
 
-    return Ok(is_stone_added);
+    return playNode(tree.addChild(
+        line[getMoveNumber()],
+        packStone(position.getSize(), stone),
+        next_hash,
+        captured
+    ));
 }
 
-int GoBoardState::getCaptures (GoTurn turn) {
-    int captures = 0;
-    for (int i = 0; i < actions.size() - undo_by; i++) {
-        auto action = actions[i];
+GoBitboard GoBoardState::computeLegalMoves (GoTurn turn) const {
+    GoBitboard legal;
+    if (this->computed.isGameEnded())
+        return legal;
+
+    const GoBoardPosition& position = this->computed.getPosition();
+    const GoGroupTable& groups = this->computed.getGroups();
+    int size = position.getSize();
+
+    // Last liberties of enemy groups in atari, playing there captures
+    GoBitboard capturing;
+    position.getStones(getOppositeTurn(turn)).forEach([&](int index) {
+        int point = position.indexToPoint(index);
+        if (groups.getGroup(point) == point && groups.getLibertyCount(point) == 1) {
+            capturing |= groups.getLiberties(point);
+        }
+    });
+
+    // Without a capture, a move with an empty neighbour is never suicide and
+    // one without needs a friendly group to keep a liberty
+    GoBitboard empty = position.getEmpty();
+    GoBitboard quiet = empty & ~capturing;
+    legal = quiet & withBoardGeometry(computed.getKernels(), position, [&](const auto& geometry) {
+        return geometry.getNeighbours(empty);
+    });
+
+    (quiet & ~legal).forEach([&](int index) {
+        if (GoBoardRuleManager::isValidStoneIgnoringCapture(this->computed, {turn, index / size, index % size})) {
+            legal.set(index);
+        }
+    });
+
+    // Capturing is never suicide but may bring back an earlier position
+    (empty & capturing).forEach([&](int index) {
+        GoStone stone = {turn, index / size, index % size};
+
+        std::vector<GoStone> removed_stones;
+        for (auto group : GoBoardRuleManager::getCapturedGroups(this->computed, stone)) {
+            removed_stones.insert(removed_stones.end(), group.begin(), group.end());
+        }
 
-        captures +=
-            std::visit([&](auto&& action) -> int {
-                using T = std::decay_t<decltype(action)>;
+        if (!isRepeatedPosition(this->computed.getHashAfter(stone, removed_stones))) {
+            legal.set(index);
+        }
+    });
+
+    // Simple ko needs the captured stone back on the board, a superko can
+    // also be broken by a quiet move
+    if (ko_rule != GoKoRule::SIMPLE_KO) {
+        (quiet & legal).forEach([&](int index) {
+            GoStone stone = {turn, index / size, index % size};
+            if (isRepeatedPosition(this->computed.getHashAfter(stone, {}))) {
+                legal.reset(index);
+            }
+        });
+    }
 
-                if constexpr (std::is_same_v<T, CaptureStonesAction>) {
-                    if (action.capturing_stone.turn == turn)
-                        return action.removed_stones.size();
-                }
+    return legal;
+}
 
-                return 0;
-            }, action);
+const GoBitboard& GoBoardState::getLegalMoves (GoTurn turn) const {
+    std::optional<GoBitboard>& legal = legal_moves[getTurnIndex(turn)];
+    if (!legal.has_value()) {
+        legal = computeLegalMoves(turn);
     }
-    return captures;
+    return legal.value();
+}
+
+std::vector<GoStone> GoBoardState::getIllegalMoves (GoTurn turn) const {
+    const GoBoardPosition& position = this->computed.getPosition();
+    int size = position.getSize();
+
+    std::vector<GoStone> illegal;
+    (position.getEmpty() & ~getLegalMoves(turn)).forEach([&](int index) {
+        illegal.push_back({turn, index / size, index % size});
+    });
+    return illegal;
 }
@@ -5,16 +5,17 @@
 #include "helpers.hpp"
 #include "error.hpp"
 #include "base.hpp"
+#include "groups.hpp"
+#include "kernels.hpp"
+#include "position.hpp"
+#include "tree.hpp"
 #include <SDL3/SDL_log.h>
+#include <array>
+#include <cstdint>
 #include <optional>
+#include <unordered_map>
 #include <vector>
 
-enum class GoBoardCellState {
-    EMPTY = 0,
-    BLACK = 1,
-    WHITE = 2
-};
-
 inline std::optional<GoTurn> getTurnFromCellState (GoBoardCellState state) {
     if (state == GoBoardCellState::BLACK)
         return std::make_optional<GoTurn>(GoTurn::BLACK);
@@ -24,72 +25,217 @@ inline std::optional<GoTurn> getTurnFromCellState (GoBoardCellState state) {
     return std::nullopt;
 }
 
+inline bool doesCellValidateStone (GoBoardCellState cell_state, const GoStone& stone) {
+    return (cell_state == GoBoardCellState::BLACK && stone.turn == GoTurn::BLACK)
+        || (cell_state == GoBoardCellState::WHITE && stone.turn == GoTurn::WHITE);
+}
+
+// What a checkpoint keeps of a GoBoardStateComputed. The group table, about
+// 24KB on a 19x19 board, is left out and rebuilt from the stones on restore.
+struct GoBoardCheckpoint {
+    GoBoardPosition position;
+    std::optional<GoTurn> in_pass;
+    bool is_ended;
+};
+
 class GoBoardStateComputed {
     bool is_ended = false;
     std::optional<GoTurn> in_pass = std::nullopt;
-    std::vector<std::vector<GoBoardCellState>> state;
+    GoBoardPosition position;
+    GoGroupTable groups;
+
+    // Picked once from the board size, see kernels.hpp
+    GoBoardKernels kernels;
 
 public:
-    GoBoardStateComputed (int size): state(size, std::vector<GoBoardCellState>(size, GoBoardCellState::EMPTY)), is_ended(false) {};
+    GoBoardStateComputed (int size): GoBoardStateComputed(size, getBoardKernels(size)) {};
+    GoBoardStateComputed (int size, GoBoardKernels kernels):
+        is_ended(false), position(size), kernels(kernels) {};
     GoBoardStateComputed (
-        std::vector<std::vector<GoBoardCellState>> state,
+        const std::vector<std::vector<GoBoardCellState>>& state,
         std::optional<GoTurn> in_pass,
         bool is_ended
-    ): state(state),
+    ): is_ended(is_ended),
        in_pass(in_pass),
-       is_ended(is_ended)
-    {};
-
-    bool operator==(const GoBoardStateComputed& other) const {
-        if (state.size() != other.state.size())
-            return false;
-
+       position(state.size()),
+       kernels(getBoardKernels(state.size()))
+    {
         for (int x = 0; x < state.size(); x++) {
             for (int y = 0; y < state[x].size(); y++) {
-                if (state[x][y] != other.state[x][y]) {
-                    return false;
-                }
+                position.set(x, y, state[x][y]);
             }
         }
+        withBoardGeometry(kernels, position, [&](const auto& geometry) {
+            groups.build(position, geometry);
+        });
+    };
+
+    bool operator==(const GoBoardStateComputed& other) const {
+        return position == other.position;
+    }
+
+    void placeStone (const GoStone& stone) {
+        int point = position.toPoint(stone.x, stone.y);
+        withBoardGeometry(kernels, position, [&](const auto& geometry) {
+            groups.place(position, geometry, point, stone.turn);
+        });
+    }
+
+    void removeStones (const std::vector<GoStone>& stones) {
+        std::vector<int> points;
+        points.reserve(stones.size());
+        for (const GoStone& stone : stones) {
+            points.push_back(position.toPoint(stone.x, stone.y));
+        }
+        withBoardGeometry(kernels, position, [&](const auto& geometry) {
+            groups.remove(position, geometry, points);
+        });
+    }
+
+    GoBoardCheckpoint getCheckpoint () const { return {position, in_pass, is_ended}; }
 
-        return true;
+    void restore (const GoBoardCheckpoint& checkpoint) {
+        position = checkpoint.position;
+        in_pass = checkpoint.in_pass;
+        is_ended = checkpoint.is_ended;
+        withBoardGeometry(kernels, position, [&](const auto& geometry) {
+            groups.build(position, geometry);
+        });
     }
 
+    void setPassState (std::optional<GoTurn> in_pass, bool is_ended) {
+        this->in_pass = in_pass;
+        this->is_ended = is_ended;
+    }
+
+    // Plays the move of a node of tree on top of this state. The tree keeps
+    // the stones each move removed, so unapply() can reverse it without a
+    // replay given the pass state from before the move.
+    std::optional<GoErrorEnum> apply (const GoGameTree& tree, const GoGameNode& node);
+    void unapply (const GoGameTree& tree, const GoGameNode& node, std::optional<GoTurn> prev_in_pass);
+
+    // Hash of the position after stone is played here and removed_stones
+    // are taken off, with the other player to move
+    GoPositionHash getHashAfter (const GoStone& stone, const std::vector<GoStone>& removed_stones) const;
+
     bool isGameEnded () const { return is_ended; }
     std::optional<GoTurn> inPass () const { return in_pass; }
-    GoBoardCellState get (int x, int y) const { return state[x][y]; }
-    int getSize () const { return state.size(); }
+    GoBoardCellState get (int x, int y) const { return position.get(x, y); }
+    int getSize () const { return position.getSize(); }
+    const GoBoardPosition& getPosition () const { return position; }
+    const GoGroupTable& getGroups () const { return groups; }
+    GoBoardKernels getKernels () const { return kernels; }
+};
+
+enum class GoKoRule {
+    SIMPLE_KO,              // only retaking a ko immediately is banned
+    POSITIONAL_SUPERKO,     // no board position may repeat
+    SITUATIONAL_SUPERKO     // no board position may repeat with the same player to move
 };
 
+#define GO_DEFAULT_CHECKPOINT_INTERVAL 32
+
 class GoBoardState {
     int undo_by = 0;
-    std::vector<GoBoardAction> actions;
+
+    // Every variation played so far, and the one being followed: line[i] is
+    // the node after i moves, redo tail included
+    GoGameTree tree;
+    std::vector<GoGameLine> line;
 
     GoBoardStateComputed computed;
     GoBoardSize dim;
 
-    void handleUndoClear ();
+    // The first seen maps hold the lowest i for every hash of line[i]
+    GoKoRule ko_rule = GoKoRule::SIMPLE_KO;
+    std::unordered_map<uint64_t, int> first_seen_positions;
+    std::unordered_map<uint64_t, int> first_seen_situations;
+
+    // checkpoints[i] is the state after i * checkpoint_interval moves of the
+    // line, for every such move reached since the line last changed
+    int checkpoint_interval = GO_DEFAULT_CHECKPOINT_INTERVAL;
+    std::vector<GoBoardCheckpoint> checkpoints;
+
+    std::optional<GoTurn> getPassStateBefore (int move_number) const;
+
+    void pushLine (const GoGameLine& node);
+    void truncateLine (int size);
+    void extendLine ();
+    Result<bool, GoErrorEnum> playNode (const GoGameLine& node);
+    bool isRepeatedPosition (const GoPositionHash& next) const;
+
+    void pushCheckpointIfDue ();
+
+    // Legal moves of each colour in the current position, filled on first
+    // use and dropped whenever the position or the ko rule changes
+    mutable std::array<std::optional<GoBitboard>, 2> legal_moves;
+
+    void invalidateLegalMoves () { legal_moves = {}; }
+    GoBitboard computeLegalMoves (GoTurn turn) const;
 
 public:
-    GoBoardState(GoBoardSize dim): dim(dim), actions(0), computed(static_cast<int>(dim)) {}
+    GoBoardState(GoBoardSize dim):
+        tree(getPositionHash(0, GoTurn::BLACK)),
+        computed(static_cast<int>(dim)),
+        dim(dim) { clear(); }
 
     void clear ();
 
+    void setKoRule (GoKoRule ko_rule) {
+        this->ko_rule = ko_rule;
+        invalidateLegalMoves();
+    }
+    GoKoRule getKoRule () const { return ko_rule; }
+    GoPositionHash getHash () const { return line[getMoveNumber()]->hash; }
+
+    // Smaller intervals use more memory but make seek() apply fewer moves
+    void setCheckpointInterval (int checkpoint_interval);
+    int getCheckpointInterval () const { return checkpoint_interval; }
+
+    // Playing after an undo starts a new variation (or rejoins an existing
+    // one), the previous line stays in the tree
     Result<bool, GoErrorEnum> pass (GoTurn turn);
     Result<bool, GoErrorEnum> addStone (GoStone stone);
     Result<bool, GoErrorEnum> undo ();
     Result<bool, GoErrorEnum> redo ();
 
-    std::vector<GoBoardAction> getActionsWithUndo () {
-        return std::vector(
-            this->actions.begin(),
-            this->actions.end()-undo_by
-        );
+    // Moves to the position after the first move_number moves of the line,
+    // from the current position or the nearest checkpoint, whichever is closer
+    Result<bool, GoErrorEnum> seek (int move_number);
+
+    // Variations are the children of the current node, in the order they were
+    // first played. Switching makes redo follow another one.
+    int getVariationCount () const { return tree.getChildren(line[getMoveNumber()].get()).size(); }
+    int getVariationIndex () const;
+    bool switchVariation (int offset);
+
+    // Empty points where turn may play without suicide or breaking the ko
+    // rule, indexed like the position bitboards. Empty once the game ends.
+    const GoBitboard& getLegalMoves (GoTurn turn) const;
+
+    bool isLegalMove (const GoStone& stone) const {
+        return getLegalMoves(stone.turn).test(computed.getPosition().toIndex(stone.x, stone.y));
     }
 
-    std::vector<GoBoardAction> getActions () { return this->actions; }
-    GoBoardStateComputed getComputed () { return this->computed; }
-    int getCaptures (GoTurn turn);
+    // Empty points where turn may not play
+    std::vector<GoStone> getIllegalMoves (GoTurn turn) const;
+
+    int getMoveNumber () const { return line.size() - 1 - undo_by; }
+    int getMoveCount () const { return line.size() - 1; }
+
+    GoTurn getTurnToPlay () const { return line[getMoveNumber()]->getTurnToPlay(); }
+
+    // The current position, and through its parents the moves leading to it
+    GoGameLine getCurrentNode () const { return line[getMoveNumber()]; }
+    GoGameLine getLastNode () const { return line.back(); }
+
+    const GoGameTree& getTree () const { return this->tree; }
+    const GoBoardStateComputed& getComputed () const { return this->computed; }
+
+    // Totals kept on the nodes, so these hold for any position of the line
+    const GoPositionStats& getStats () const { return line[getMoveNumber()]->stats; }
+    int getCaptures (GoTurn turn) const { return getStats().captures[getTurnIndex(turn)]; }
+    int getStoneCount (GoTurn turn) const { return getStats().stones[getTurnIndex(turn)]; }
 };
 
 #endif
@@ -1,10 +1,17 @@
 #include "base.hpp"
 #include "katago.hpp"
+#include "katago_framer.hpp"
 #include "rules.hpp"
 #include "state.hpp"
 #include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <optional>
+#include <thread>
 
 inline bool areGroupsEqual(
     const std::vector<std::vector<GoStone>>& expected_groups,
@@ -136,6 +143,392 @@ inline bool testValidPlacement () {
         && is_valid_test_3;
 }
 
+inline bool testGroupTable () {
+    std::vector<std::vector<GoBoardCellState>> state =
+    {
+        {_, O, O, O, _, _, _, _, _},
+        {O, X, X, X, O, _, _, _, _},
+        {_, O, _, O, _, _, _, _, _},
+        {_, _, _, _, _, _, _, _, _},
+        {_, _, _, _, _, _, _, _, _},
+        {_, _, _, _, _, _, _, _, _},
+        {_, _, _, _, _, _, _, _, _},
+        {_, _, _, _, _, _, _, _, _},
+        {_, _, _, _, _, _, _, _, _},
+    };
+
+    GoBoardStateComputed computed(state, std::nullopt, false);
+    const GoBoardPosition& board = computed.getPosition();
+    const GoGroupTable& groups = computed.getGroups();
+
+    bool is_valid_test_0 = GoBoardRuleManager::isInAtari(computed, 1, 2);
+    printTestResult("testGroupTable[0]", is_valid_test_0);
+
+    // Extending keeps the group in atari, now on (3,2)
+    computed.placeStone({B, 2, 2});
+    int black_root = groups.getGroup(board.toPoint(1, 1));
+    bool is_valid_test_1 = GoBoardRuleManager::isInAtari(computed, 2, 2)
+        && groups.getStoneCount(black_root) == 4
+        && groups.getLiberties(black_root).test(board.toIndex(3, 2));
+    printTestResult("testGroupTable[1]", is_valid_test_1);
+
+    // Undoing it gives (2,2) back as a liberty to both colours
+    computed.removeStones({{B, 2, 2}});
+    black_root = groups.getGroup(board.toPoint(1, 1));
+    int white_root = groups.getGroup(board.toPoint(2, 1));
+    bool is_valid_test_2 = groups.getStoneCount(black_root) == 3
+        && groups.getLibertyCount(black_root) == 1
+        && groups.getLibertyCount(white_root) == 3;
+    printTestResult("testGroupTable[2]", is_valid_test_2);
+
+    std::cout << std::endl;
+
+    return is_valid_test_0
+        && is_valid_test_1
+        && is_valid_test_2;
+}
+
+inline bool testKo () {
+    GoBoardState state(GoBoardSize::_9x9);
+
+    std::vector<GoStone> setup = {
+        {B, 0, 1}, {W, 0, 2},
+        {B, 2, 1}, {W, 2, 2},
+        {B, 1, 0}, {W, 1, 3},
+        {W, 1, 1}, {B, 1, 2}
+    };
+    for (const GoStone& stone : setup) {
+        state.addStone(stone);
+    }
+
+    bool is_valid_test_0 = state.getComputed().get(1, 1) == GoBoardCellState::EMPTY;
+    printTestResult("testKo[0]", is_valid_test_0);
+
+    // Retaking straight away repeats the position
+    Result<bool, GoErrorEnum> res_1 = state.addStone({W, 1, 1});
+    bool is_valid_test_1 = res_1.is_ok() && !res_1.ok_value();
+    printTestResult("testKo[1]", is_valid_test_1);
+
+    // After a ko threat exchange it is allowed
+    state.addStone({W, 5, 5});
+    state.addStone({B, 6, 6});
+    Result<bool, GoErrorEnum> res_2 = state.addStone({W, 1, 1});
+    bool is_valid_test_2 = res_2.is_ok() && res_2.ok_value()
+        && state.getComputed().get(1, 2) == GoBoardCellState::EMPTY;
+    printTestResult("testKo[2]", is_valid_test_2);
+
+    // Three of the testKo shapes side by side, the first two holding a white
+    // stone and the last a black one, black to move
+    auto setupKos = [] (GoKoRule ko_rule) {
+        GoBoardState kos(GoBoardSize::_9x9);
+        kos.setKoRule(ko_rule);
+        for (int x = 0; x < 9; x += 3) {
+            std::vector<GoStone> walls = {
+                {B, x, 1}, {W, x, 2},
+                {B, x + 2, 1}, {W, x + 2, 2},
+                {B, x + 1, 0}, {W, x + 1, 3}
+            };
+            for (const GoStone& stone : walls) {
+                kos.addStone(stone);
+            }
+        }
+        kos.addStone({B, 7, 2});
+        kos.addStone({W, 1, 1});
+        kos.addStone({W, 4, 1});
+        return kos;
+    };
+
+    // Triple ko: each take is allowed on its own, the sixth one brings back
+    // the starting position with black to move again
+    std::vector<GoStone> triple_ko = {
+        {B, 1, 2}, {W, 7, 1}, {B, 4, 2},
+        {W, 1, 1}, {B, 7, 2}
+    };
+    auto playTripleKo = [&] (GoKoRule ko_rule) {
+        GoBoardState kos = setupKos(ko_rule);
+        bool is_played = true;
+        for (const GoStone& stone : triple_ko) {
+            Result<bool, GoErrorEnum> res = kos.addStone(stone);
+            is_played = is_played && res.is_ok() && res.ok_value();
+        }
+        Result<bool, GoErrorEnum> res = kos.addStone({W, 4, 1});
+        return is_played && res.is_ok() && res.ok_value();
+    };
+
+    bool is_valid_test_3 = playTripleKo(GoKoRule::SIMPLE_KO)
+        && !playTripleKo(GoKoRule::POSITIONAL_SUPERKO)
+        && !playTripleKo(GoKoRule::SITUATIONAL_SUPERKO);
+    printTestResult("testKo[3]", is_valid_test_3);
+
+    // With a black pass in between, the last take brings back the starting
+    // position with white to move instead
+    auto playPassKo = [&] (GoKoRule ko_rule) {
+        GoBoardState kos = setupKos(ko_rule);
+        kos.addStone({B, 1, 2});
+        kos.addStone({W, 7, 1});
+        kos.pass(B);
+        kos.addStone({W, 1, 1});
+        bool is_legal = kos.isLegalMove({B, 7, 2});
+        Result<bool, GoErrorEnum> res = kos.addStone({B, 7, 2});
+        return is_legal && res.is_ok() && res.ok_value()
+            && kos.getComputed().get(7, 1) == GoBoardCellState::EMPTY;
+    };
+
+    bool is_valid_test_4 = playPassKo(GoKoRule::SIMPLE_KO)
+        && !playPassKo(GoKoRule::POSITIONAL_SUPERKO)
+        && playPassKo(GoKoRule::SITUATIONAL_SUPERKO);
+    printTestResult("testKo[4]", is_valid_test_4);
+
+    std::cout << std::endl;
+
+    return is_valid_test_0
+        && is_valid_test_1
+        && is_valid_test_2
+        && is_valid_test_3
+        && is_valid_test_4;
+}
+
+inline bool testGameTree () {
+    GoBoardState state(GoBoardSize::_19x19);
+    state.addStone({B, 3, 3});
+    state.addStone({W, 15, 15});
+    state.addStone({B, 3, 15});
+    GoGameLine first = state.getCurrentNode();
+
+    // A new move after an undo branches off instead of dropping the old line
+    state.undo();
+    state.addStone({B, 15, 3});
+    GoGameLine second = state.getCurrentNode();
+
+    bool is_valid_test_0 = state.getTree().getNodeCount() == 5
+        && first->parent == second->parent
+        && state.getMoveCount() == 3
+        && *KataGoMoveList().update(GoBoardSize::_19x19, second) == R"(["B","D16"],["W","Q4"],["B","D4"])";
+    printTestResult("testGameTree[0]", is_valid_test_0);
+
+    // Switching the variation makes redo follow the first line again
+    state.undo();
+    bool switched = state.getVariationCount() == 2
+        && state.getVariationIndex() == 1
+        && state.switchVariation(1);
+    state.redo();
+
+    bool is_valid_test_1 = switched
+        && state.getCurrentNode() == first
+        && state.getComputed().get(3, 15) == GoBoardCellState::BLACK
+        && state.getComputed().get(15, 3) == GoBoardCellState::EMPTY;
+    printTestResult("testGameTree[1]", is_valid_test_1);
+
+    // Replaying a known move rejoins its node
+    state.undo();
+    state.addStone({B, 15, 3});
+    bool is_valid_test_2 = state.getCurrentNode() == second
+        && state.getTree().getNodeCount() == 5;
+    printTestResult("testGameTree[2]", is_valid_test_2);
+
+    // The hash of a child is known before it is played, captures included
+    GoBoardState corner(GoBoardSize::_9x9);
+    corner.addStone({B, 0, 1});
+    corner.addStone({W, 0, 0});
+    GoPositionHash predicted = corner.getComputed().getHashAfter({B, 1, 0}, {{W, 0, 0}});
+    corner.addStone({B, 1, 0});
+
+    bool is_valid_test_3 = predicted.position == corner.getHash().position
+        && predicted.situation == corner.getHash().situation;
+    printTestResult("testGameTree[3]", is_valid_test_3);
+
+    std::cout << std::endl;
+
+    return is_valid_test_0
+        && is_valid_test_1
+        && is_valid_test_2
+        && is_valid_test_3;
+}
+
+inline bool testPositionStats () {
+    GoBoardState state(GoBoardSize::_9x9);
+    state.addStone({B, 0, 1});
+    state.addStone({W, 0, 0});
+    state.addStone({B, 1, 0});
+    state.pass(W);
+
+    bool is_valid_test_0 = state.getCaptures(B) == 1
+        && state.getCaptures(W) == 0
+        && state.getStoneCount(B) == 2
+        && state.getStoneCount(W) == 0
+        && state.getMoveNumber() == 4;
+    printTestResult("testPositionStats[0]", is_valid_test_0);
+
+    // Every position of the line keeps its own totals
+    state.undo();
+    state.undo();
+    bool undone = state.getCaptures(B) == 0 && state.getStoneCount(W) == 1;
+    state.seek(4);
+
+    bool is_valid_test_1 = undone
+        && state.getCaptures(B) == 1
+        && state.getStoneCount(B) == 2;
+    printTestResult("testPositionStats[1]", is_valid_test_1);
+
+    // A line past two checkpoints, with the board and totals after every move
+    GoBoardState long_line(GoBoardSize::_9x9);
+    std::vector<std::vector<GoBoardCellState>> boards;
+    std::vector<GoPositionStats> stats;
+    auto record = [&] () {
+        std::vector<GoBoardCellState> cells;
+        for (int x = 0; x < 9; x++) {
+            for (int y = 0; y < 9; y++) {
+                cells.push_back(long_line.getComputed().get(x, y));
+            }
+        }
+        boards.push_back(cells);
+        stats.push_back(long_line.getStats());
+    };
+    record();
+    int line_length = 2 * GO_DEFAULT_CHECKPOINT_INTERVAL + 8;
+    for (int move = 0; move < line_length; move++) {
+        GoTurn turn = move % 2 == 0 ? B : W;
+        for (int offset = 0; offset < 81; offset++) {
+            int index = (move * 3 + offset) % 81;
+            if (long_line.isLegalMove({turn, index / 9, index % 9})) {
+                long_line.addStone({turn, index / 9, index % 9});
+                break;
+            }
+        }
+        record();
+    }
+
+    auto isSeekedTo = [&] (int move_number) {
+        long_line.seek(move_number);
+        std::vector<GoBoardCellState> cells;
+        for (int x = 0; x < 9; x++) {
+            for (int y = 0; y < 9; y++) {
+                cells.push_back(long_line.getComputed().get(x, y));
+            }
+        }
+        const GoPositionStats& expected = stats[move_number];
+        return long_line.getMoveNumber() == move_number
+            && cells == boards[move_number]
+            && long_line.getCaptures(B) == expected.captures[0]
+            && long_line.getCaptures(W) == expected.captures[1]
+            && long_line.getStoneCount(B) == expected.stones[0]
+            && long_line.getStoneCount(W) == expected.stones[1];
+    };
+
+    // Back past the second checkpoint, forward across it, onto it, then
+    // back from the first one to the move before it
+    bool is_valid_test_2 = long_line.getMoveNumber() == line_length
+        && stats.back().captures[0] > 0
+        && stats.back().captures[1] > 0
+        && isSeekedTo(GO_DEFAULT_CHECKPOINT_INTERVAL + 1)
+        && isSeekedTo(2 * GO_DEFAULT_CHECKPOINT_INTERVAL + 3)
+        && isSeekedTo(2 * GO_DEFAULT_CHECKPOINT_INTERVAL)
+        && isSeekedTo(GO_DEFAULT_CHECKPOINT_INTERVAL)
+        && isSeekedTo(GO_DEFAULT_CHECKPOINT_INTERVAL - 1)
+        && isSeekedTo(line_length);
+    printTestResult("testPositionStats[2]", is_valid_test_2);
+
+    std::cout << std::endl;
+
+    return is_valid_test_0
+        && is_valid_test_1
+        && is_valid_test_2;
+}
+
+inline bool testLegalMoves () {
+    GoBoardState state(GoBoardSize::_9x9);
+
+    // Same ko as testKo, plus a black eye at (8,8)
+    std::vector<GoStone> setup = {
+        {B, 0, 1}, {W, 0, 2},
+        {B, 2, 1}, {W, 2, 2},
+        {B, 1, 0}, {W, 1, 3},
+        {W, 1, 1}, {B, 8, 7},
+        {W, 5, 5}, {B, 7, 8},
+        {W, 5, 6}, {B, 1, 2}
+    };
+    for (const GoStone& stone : setup) {
+        state.addStone(stone);
+    }
+
+    // Ko, suicide in both corners and occupied points are out, the rest is in
+    const GoBitboard& white = state.getLegalMoves(W);
+    bool is_valid_test_0 = !state.isLegalMove({W, 1, 1})
+        && !state.isLegalMove({W, 0, 0})
+        && !state.isLegalMove({W, 8, 8})
+        && !state.isLegalMove({W, 1, 2})
+        && white.count() == 81 - 11 - 3;
+    printTestResult("testLegalMoves[0]", is_valid_test_0);
+
+    // Black may fill either point
+    bool is_valid_test_1 = state.isLegalMove({B, 1, 1})
+        && state.isLegalMove({B, 8, 8})
+        && state.getIllegalMoves(W).size() == 3;
+    printTestResult("testLegalMoves[1]", is_valid_test_1);
+
+    std::cout << std::endl;
+
+    return is_valid_test_0
+        && is_valid_test_1;
+}
+
+inline bool testBoardKernels () {
+    typedef GoPosition<9> Position;
+
+    GoBitboard corner;
+    corner.set(Position::toIndex(0, 0));
+    GoBitboard expected_corner;
+    expected_corner.set(Position::toIndex(1, 0));
+    expected_corner.set(Position::toIndex(0, 1));
+
+    // (0, 8) and (1, 0) are next to each other in index order, not on the board
+    GoBitboard edge;
+    edge.set(Position::toIndex(0, 8));
+    GoBitboard expected_edge;
+    expected_edge.set(Position::toIndex(0, 7));
+    expected_edge.set(Position::toIndex(1, 8));
+
+    bool is_valid_test_0 = Position::getNeighbours(corner) == expected_corner
+        && Position::getNeighbours(edge) == expected_edge
+        && Position::pointToIndex(Position::toPoint(8, 8)) == 80
+        && Position::pointToIndex(0) == -1;
+    printTestResult("testBoardKernels[0]", is_valid_test_0);
+
+    // The 9x9 kernels and the generic ones build the same groups
+    GoBoardStateComputed specialised(9);
+    GoBoardStateComputed generic(9, getGenericBoardKernels());
+
+    std::vector<GoStone> stones = {
+        {B, 0, 1}, {W, 0, 2}, {B, 2, 1}, {W, 2, 2},
+        {B, 1, 0}, {W, 1, 3}, {W, 1, 1}, {B, 1, 2}
+    };
+    for (const GoStone& stone : stones) {
+        for (GoBoardStateComputed* computed : {&specialised, &generic}) {
+            std::vector<GoStone> removed_stones;
+            for (auto group : GoBoardRuleManager::getCapturedGroups(*computed, stone)) {
+                removed_stones.insert(removed_stones.end(), group.begin(), group.end());
+            }
+            computed->placeStone(stone);
+            computed->removeStones(removed_stones);
+        }
+    }
+
+    const GoBoardPosition& board = specialised.getPosition();
+    int root = specialised.getGroups().getGroup(board.toPoint(1, 2));
+    int generic_root = generic.getGroups().getGroup(board.toPoint(1, 2));
+
+    bool is_valid_test_1 = specialised.getKernels() == GoBoardKernels::SIZE_9x9
+        && specialised == generic
+        && specialised.get(1, 1) == GoBoardCellState::EMPTY
+        && specialised.getGroups().getLiberties(root) == generic.getGroups().getLiberties(generic_root);
+    printTestResult("testBoardKernels[1]", is_valid_test_1);
+
+    std::cout << std::endl;
+
+    return is_valid_test_0
+        && is_valid_test_1;
+}
+
 inline bool testValidKatago () {
     GoStone stone = {GoTurn::BLACK, 4, 8};
     std::vector<std::string> move = stoneToKatagoMove(GoBoardSize::_9x9, stone);
@@ -155,6 +548,510 @@ inline bool testValidKatago () {
         && is_valid_test_1;
 }
 
+// A response as the reader decodes it from a line of KataGo output
+inline KataGoResponse decodeResponse (const json& line) {
+    KataGoResponse response;
+    KataGoResponseDecoder::decode(line.dump(), response);
+    return response;
+}
+
+inline bool testResponseDecoder () {
+    // Fields we do not use are skipped, however deep, even when their keys
+    // are ones we use elsewhere
+    std::string line = R"({"id":"q7","isDuringSearch":false,"turnNumber":3,)"
+        R"("moveInfos":[{"move":"D4","order":0,"visits":12,"winrate":0.45,"scoreLead":-3.0,)"
+        R"("pv":["D4","C3"],"ownership":[0.9,0.9,0.9,0.9]},)"
+        R"({"move":"pass","visits":3,"winrate":0.4,"scoreLead":-4,"pvVisits":[3]}],)"
+        R"("rootInfo":{"currentPlayer":"W","scoreLead":-3.5,"thisHash":"AB","rawStScoreError":{"id":"x"}},)"
+        R"("ownership":[0.5,-1,0.25,0],"policy":[{"id":"y","turnNumber":9}]})";
+
+    KataGoResponse response;
+    bool is_decoded = KataGoResponseDecoder::decode(line, response);
+
+    bool is_valid_test_0 = is_decoded
+        && response.id == "q7"
+        && response.turn_number == 3
+        && !response.is_during_search
+        && response.current_player == "W"
+        && response.score_lead == -3.5
+        && response.move_infos.size() == 2
+        && response.move_infos[0].move == "D4"
+        && response.move_infos[0].visits == 12
+        && response.move_infos[1].move == "pass"
+        && response.move_infos[1].score_lead == -4
+        && response.ownership == std::vector<double>{0.5, -1, 0.25, 0};
+    printTestResult("testResponseDecoder[0]", is_valid_test_0);
+
+    std::optional<KataGoEvaluation> evaluation = KataGoEngine::parseEvaluation(response);
+    bool is_valid_test_1 = evaluation.has_value()
+        && evaluation->ownership.size() == 2
+        && evaluation->ownership[0][1] == -1
+        && evaluation->ownership[1][0] == 0.25
+        && evaluation->candidates.size() == 2
+        && KataGoEngine::parseNextMove(response).value() == std::vector<std::string>{"W", "D4"};
+    printTestResult("testResponseDecoder[1]", is_valid_test_1);
+
+    // A reused response keeps nothing of the previous line, and a line cut
+    // short is not a response
+    bool is_valid_test_2 = KataGoResponseDecoder::decode(R"({"id":"q8","warning":"unused field"})", response)
+        && response.id == "q8"
+        && response.warning == "unused field"
+        && response.turn_number == -1
+        && response.move_infos.empty()
+        && !KataGoEngine::isEvaluation(response)
+        && !KataGoResponseDecoder::decode(R"({"id":"q9","ownership":[0.5,)", response);
+    printTestResult("testResponseDecoder[2]", is_valid_test_2);
+
+    std::cout << std::endl;
+    return is_valid_test_0
+        && is_valid_test_1
+        && is_valid_test_2;
+}
+
+inline bool testKataGoSettings () {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "go-test-settings";
+    std::filesystem::create_directories(dir);
+    std::string path = (dir / "settings.json").string();
+
+    auto writeSettings = [&](int max_visits) {
+        // Saved the way editors do, by renaming a new file over the old one
+        std::string temp_path = (dir / "settings.json.tmp").string();
+        std::ofstream(temp_path) << json({
+            {"levels", {{"LEVEL_3", {{"maxVisits", max_visits}, {"rootPolicyTemperature", 0.6}}}}},
+            {"evaluation", {{"maxVisits", max_visits * 2}}}
+        }).dump();
+        std::filesystem::rename(temp_path, path);
+    };
+
+    writeSettings(150);
+    KataGoSettings::load(path);
+    KataGoQuery query;
+    KataGoSettings::applyDiffLevel(query, KataGoLevel::LEVEL_3);
+
+    // Levels missing from the file keep their defaults
+    KataGoQuery default_query;
+    KataGoSettings::applyDiffLevel(default_query, KataGoLevel::LEVEL_1);
+
+    bool is_valid_test_0 = query.max_visits == 150
+        && default_query.max_visits == 800;
+    printTestResult("testKataGoSettings[0]", is_valid_test_0);
+
+    // A change to the file is picked up without loading it by hand, and a
+    // file that does not parse keeps the settings in use
+    bool is_reloaded = false;
+    {
+        KataGoSettingsWatcher watcher(path);
+        writeSettings(300);
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(KATAGO_SETTINGS_POLL_SECONDS * 3);
+        while (!is_reloaded && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            is_reloaded = KataGoSettings::getSnapshot()->get(KataGoLevel::LEVEL_3).max_visits == 300;
+        }
+    }
+    std::ofstream(path) << "{\"levels\": ";
+    bool is_kept = !KataGoSettings::load(path);
+    KataGoSettings::applyEvaluationConfig(query);
+
+    bool is_valid_test_1 = is_reloaded
+        && is_kept
+        && query.max_visits == 600;
+    printTestResult("testKataGoSettings[1]", is_valid_test_1);
+
+    std::filesystem::remove_all(dir);
+    KataGoSettings::load();
+
+    std::cout << std::endl;
+    return is_valid_test_0
+        && is_valid_test_1;
+}
+
+inline bool testKataGoMoveList () {
+    GoBoardState state(GoBoardSize::_9x9);
+    KataGoMoveList moves;
+    moves.update(GoBoardSize::_9x9, state.getCurrentNode());
+
+    state.addStone({B, 4, 4});
+    state.addStone({W, 2, 6});
+    state.pass(B);
+    KataGoMoves played = moves.update(GoBoardSize::_9x9, state.getCurrentNode());
+
+    // Back two moves and into another variation, as if written from scratch.
+    // The text already handed out is left as it was.
+    state.undo();
+    state.undo();
+    state.addStone({W, 8, 8});
+    state.addStone({B, 0, 0});
+    KataGoMoves branched = moves.update(GoBoardSize::_9x9, state.getCurrentNode());
+
+    bool is_valid_test_0 = *played == R"(["B","E5"],["W","G7"],["B","pass"])"
+        && *branched == R"(["B","E5"],["W","J1"],["B","A9"])"
+        && *branched == *KataGoMoveList().update(GoBoardSize::_9x9, state.getCurrentNode())
+        && moves.update(GoBoardSize::_9x9, state.getCurrentNode()) == branched
+        && moves.getCount() == 3;
+    printTestResult("testKataGoMoveList[0]", is_valid_test_0);
+
+    // The moves go into the query as its "moves" array, its own next moves
+    // after them
+    KataGoQuery query = getEvaluationQuery("q1", GoBoardSize::_9x9);
+    query.priority = 10;
+    query.analyze_turns = {1, 3};
+    appendKataGoMove(query.next_moves, "W", "pass");
+
+    std::string line;
+    writeKataGoQuery(line, query, moves.getText());
+    json written = json::parse(line);
+
+    bool is_valid_test_1 = line.back() == '\n'
+        && written["id"] == "q1"
+        && written["boardXSize"] == 9
+        && written["komi"] == 6.5
+        && written["maxVisits"] == 20
+        && written["rootPolicyTemperature"] == 0.3
+        && written["includeOwnership"] == true
+        && written["priority"] == 10
+        && written["analyzeTurns"] == std::vector<int>{1, 3}
+        && !written.contains("reportDuringSearchEvery")
+        && written["moves"].size() == 4
+        && written["moves"][1] == std::vector<std::string>{"W", "J1"}
+        && written["moves"][3] == std::vector<std::string>{"W", "pass"};
+    printTestResult("testKataGoMoveList[1]", is_valid_test_1);
+
+    // A move query with points to avoid, from the start of the game
+    writeKataGoQuery(line, getMoveQuery("q2", GoBoardSize::_9x9, {{B, 0, 0}, {B, 1, 1}}), "");
+    json avoiding = json::parse(line);
+
+    bool is_valid_test_2 = avoiding["id"] == "q2"
+        && !avoiding.contains("maxVisits")
+        && avoiding["moves"].empty()
+        && avoiding["avoidMoves"][0]["player"] == "B"
+        && avoiding["avoidMoves"][0]["moves"] == std::vector<std::string>{"A9", "B8"}
+        && avoiding["avoidMoves"][0]["untilDepth"] == 1;
+    printTestResult("testKataGoMoveList[2]", is_valid_test_2);
+
+    std::cout << std::endl;
+    return is_valid_test_0
+        && is_valid_test_1
+        && is_valid_test_2;
+}
+
+inline bool testKataGoDispatcher () {
+    KataGoDispatcher dispatcher;
+    std::vector<std::string> answered;
+    int partial_count = 0;
+
+    dispatcher.expect("move", [&](const KataGoResponse& response) {
+        answered.push_back(response.id);
+        return true;
+    });
+    dispatcher.expect("eval", [&](const KataGoResponse& response) {
+        if (response.is_during_search) {
+            partial_count++;
+            return false;
+        }
+        answered.push_back(response.id);
+        return true;
+    });
+
+    // Answered out of order, with a partial result and a warning in between
+    bool is_routed = dispatcher.dispatch(decodeResponse({{"id", "eval"}, {"isDuringSearch", true}}))
+        && dispatcher.dispatch(decodeResponse({{"id", "move"}, {"warning", "unused field"}}))
+        && dispatcher.dispatch(decodeResponse({{"id", "move"}}))
+        && dispatcher.dispatch(decodeResponse({{"id", "eval"}}));
+
+    bool is_valid_test_0 = is_routed
+        && answered == std::vector<std::string>{"move", "eval"}
+        && partial_count == 1
+        && dispatcher.getPendingCount() == 0;
+    printTestResult("testKataGoDispatcher[0]", is_valid_test_0);
+
+    // Unknown ids are not routed anywhere
+    bool is_valid_test_1 = !dispatcher.dispatch(decodeResponse({{"id", "unknown"}}))
+        && !dispatcher.dispatch(decodeResponse({{"error", "bad query"}}))
+        && answered.size() == 2;
+    printTestResult("testKataGoDispatcher[1]", is_valid_test_1);
+
+    // A terminated query is dropped with every response still on its way,
+    // one cancelled before it is sent is never expected
+    dispatcher.expect("late", [&](const KataGoResponse&) { answered.push_back("late"); return true; });
+    dispatcher.cancel("late");
+    dispatcher.cancel("unsent");
+    bool is_valid_test_2 = dispatcher.dispatch(decodeResponse({{"id", "late"}, {"isDuringSearch", true}}))
+        && dispatcher.dispatch(decodeResponse({{"id", "late"}, {"turnNumber", 0}}))
+        && dispatcher.dispatch(decodeResponse({{"id", "late"}, {"turnNumber", 1}}))
+        && !dispatcher.expect("unsent", [&](const KataGoResponse&) { return true; })
+        && answered.size() == 2
+        && dispatcher.getPendingCount() == 0;
+    printTestResult("testKataGoDispatcher[2]", is_valid_test_2);
+
+    // A handler counting its responses, as for analyzeTurns, keeps its count
+    dispatcher.expect("turns", [remaining = 2](const KataGoResponse&) mutable { return --remaining == 0; });
+    dispatcher.dispatch(decodeResponse({{"id", "turns"}, {"turnNumber", 0}}));
+    bool is_waiting = dispatcher.getPendingCount() == 1;
+    dispatcher.dispatch(decodeResponse({{"id", "turns"}, {"turnNumber", 1}}));
+
+    bool is_valid_test_3 = is_waiting
+        && dispatcher.getPendingCount() == 0;
+    printTestResult("testKataGoDispatcher[3]", is_valid_test_3);
+
+    std::cout << std::endl;
+    return is_valid_test_0
+        && is_valid_test_1
+        && is_valid_test_2
+        && is_valid_test_3;
+}
+
+#ifndef WINDOWS
+inline bool testEnginePool () {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "go-test-pool";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    std::ofstream(dir / "config.cfg");
+    std::ofstream(dir / "model.bin.gz");
+
+    // A stand-in for KataGo, running before_answer on every query
+    auto writeEngine = [&](const std::string& name, const std::string& before_answer) {
+        std::string path = (dir / name).string();
+        std::ofstream(path)
+            << "#!/bin/sh\n"
+            << "while read -r line; do\n"
+            << "    " << before_answer << "\n"
+            << "    id=$(echo \"$line\" | sed -n 's/.*\"id\":\"\\([^\"]*\\)\".*/\\1/p')\n"
+            << "    echo \"{\\\"id\\\":\\\"$id\\\",\\\"turnNumber\\\":0}\"\n"
+            << "done\n";
+        std::filesystem::permissions(path, std::filesystem::perms::owner_all);
+
+        return std::make_unique<KataGoEnginePool>(
+            path, (dir / "config.cfg").string(), (dir / "model.bin.gz").string(), 1, [](bool) {}
+        );
+    };
+
+    // Only the first process started from a script misbehaves
+    auto once = [&](const std::string& name, const std::string& action) {
+        std::string marker = (dir / (name + ".started")).string();
+        return "[ -f " + marker + " ] || { touch " + marker + "; " + action + "; }";
+    };
+
+    auto ask = [](KataGoEnginePool& pool) {
+        KataGoQuery query;
+        query.id = pool.nextQueryId();
+        std::future<KataGoResponse> future = pool.query(query);
+        if (future.wait_for(std::chrono::seconds(10)) != std::future_status::ready)
+            return KataGoResponse();
+
+        // The answer is counted once its handler returned
+        KataGoResponse response = future.get();
+        for (int i = 0; i < 100 && pool.getStats().answered == 0 && response.error.empty(); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return response;
+    };
+
+    // A crash is not seen by the caller, the query is sent again once the
+    // process is back
+    std::unique_ptr<KataGoEnginePool> pool = writeEngine("crashing.sh", once("crashing.sh", "exit 1"));
+    KataGoResponse response = ask(*pool);
+    KataGoPoolStats stats = pool->getStats();
+
+    bool is_valid_test_0 = response.id == "q0"
+        && response.error.empty()
+        && stats.restarts == 1
+        && stats.replayed == 1
+        && stats.answered == 1
+        && !pool->isDown();
+    printTestResult("testEnginePool[0]", is_valid_test_0);
+
+    // Nor is a process that stops answering, once the query is overdue
+    pool = writeEngine("hanging.sh", once("hanging.sh", "while read -r line; do :; done"));
+    pool->setQueryTimeout(std::chrono::milliseconds(1000));
+    response = ask(*pool);
+    stats = pool->getStats();
+
+    bool is_valid_test_1 = response.id == "q0"
+        && response.error.empty()
+        && stats.hangs == 1
+        && stats.restarts == 1
+        && stats.replayed == 1;
+    printTestResult("testEnginePool[1]", is_valid_test_1);
+
+    // A query that crashes every process it is sent to ends up answered
+    // with an error, rather than left waiting
+    pool = writeEngine("failing.sh", "exit 1");
+    response = ask(*pool);
+    stats = pool->getStats();
+
+    bool is_valid_test_2 = response.id == "q0"
+        && !response.error.empty()
+        && stats.timed_out == 1
+        && stats.replayed == KATAGO_QUERY_MAX_ATTEMPTS - 1
+        && stats.answered == 0;
+    printTestResult("testEnginePool[2]", is_valid_test_2);
+
+    pool.reset();
+    std::filesystem::remove_all(dir);
+
+    std::cout << std::endl;
+    return is_valid_test_0
+        && is_valid_test_1
+        && is_valid_test_2;
+}
+#endif
+
+inline bool testLineFramer () {
+    KataGoLineFramer framer(16 * 1024);
+    std::vector<std::string> lines;
+    auto feed = [&](const std::string& bytes) {
+        auto [data, size] = framer.prepare();
+        std::memcpy(data, bytes.data(), bytes.size());
+        framer.commit(bytes.size());
+        framer.forEachLine([&](std::string_view line) { lines.emplace_back(line); });
+    };
+
+    // Several lines in one read, then one split across reads
+    feed("{\"id\":\"a\"}\n{\"id\":\"b\"}\n{\"id\"");
+    feed(":\"c\"}");
+    bool is_split = lines.size() == 2 && framer.getPendingSize() == 10;
+    feed("\n\n");
+
+    bool is_valid_test_0 = is_split
+        && lines == std::vector<std::string>{"{\"id\":\"a\"}", "{\"id\":\"b\"}", "{\"id\":\"c\"}", ""}
+        && framer.getPendingSize() == 0;
+    printTestResult("testLineFramer[0]", is_valid_test_0);
+
+    // A line longer than the buffer grows it instead of being cut
+    std::string long_line(40 * 1024, 'x');
+    lines.clear();
+    for (size_t done = 0; done < long_line.size(); done += 4096) {
+        feed(long_line.substr(done, 4096));
+    }
+    feed("\n");
+
+    bool is_valid_test_1 = lines.size() == 1
+        && lines[0] == long_line
+        && framer.getCapacity() > 40 * 1024;
+    printTestResult("testLineFramer[1]", is_valid_test_1);
+
+    std::cout << std::endl;
+    return is_valid_test_0
+        && is_valid_test_1;
+}
+
+inline bool testEvaluationCache () {
+    KataGoEvaluationCache cache(2);
+    KataGoQuery query = getEvaluationQuery("", GoBoardSize::_9x9);
+    query.max_visits = 20;
+
+    KataGoEvaluationKey a = KataGoEvaluationKey::fromQuery(1, B, query);
+    KataGoEvaluationKey b = KataGoEvaluationKey::fromQuery(2, B, query);
+    KataGoEvaluationKey c = KataGoEvaluationKey::fromQuery(3, B, query);
+
+    // Touching a makes b the least recently used
+    cache.put(a, {1.5, {}});
+    cache.put(b, {2.5, {}});
+    cache.get(a);
+    cache.put(c, {3.5, {}});
+
+    bool is_valid_test_0 = cache.getSize() == 2
+        && !cache.get(b).has_value()
+        && cache.get(a).value().score == 1.5
+        && cache.get(c).value().score == 3.5;
+    printTestResult("testEvaluationCache[0]", is_valid_test_0);
+
+    // Side to move, komi and visits are part of the key
+    query.komi = 7.5;
+    KataGoEvaluationKey other_komi = KataGoEvaluationKey::fromQuery(1, B, query);
+    query.komi = 6.5;
+    query.max_visits = 40;
+    KataGoEvaluationKey other_visits = KataGoEvaluationKey::fromQuery(1, B, query);
+
+    bool is_valid_test_1 = !cache.get(KataGoEvaluationKey::fromQuery(1, W, query)).has_value()
+        && !cache.get(other_komi).has_value()
+        && !cache.get(other_visits).has_value();
+    printTestResult("testEvaluationCache[1]", is_valid_test_1);
+
+    std::cout << std::endl;
+    return is_valid_test_0
+        && is_valid_test_1;
+}
+
+inline bool testDiskCache () {
+    std::string path = (std::filesystem::temp_directory_path() / "go-test-analysis.cache").string();
+    std::remove(path.c_str());
+
+    KataGoQuery query = getEvaluationQuery("", GoBoardSize::_9x9);
+    query.max_visits = 20;
+
+    KataGoEvaluation evaluation = {
+        -3.5,
+        std::vector<std::vector<double>>(9, std::vector<double>(9, 0.5)),
+        {{"D4", 12, 0.45, -3.0}, {"pass", 3, 0.4, -4.0}}
+    };
+    evaluation.ownership[2][3] = -1;
+
+    bool is_appended_found;
+    {
+        KataGoDiskCache cache(path, 1 << 20);
+        cache.put(KataGoEvaluationKey::fromQuery(1, B, query), evaluation);
+        cache.put(KataGoEvaluationKey::fromQuery(2, W, query), evaluation);
+
+        // Found before the file is mapped again
+        is_appended_found = cache.get(KataGoEvaluationKey::fromQuery(2, W, query)).has_value();
+    }
+
+    // A crash in the middle of an append leaves a partial record behind
+    std::ofstream(path, std::ios::binary | std::ios::app) << "torn";
+
+    // Lookups miss until the file is loaded, they never wait for it
+    KataGoDiskCache reopened(path, 1 << 20);
+    bool is_missed_before_load = !reopened.get(KataGoEvaluationKey::fromQuery(1, B, query)).has_value();
+    reopened.load();
+    std::optional<KataGoEvaluation> loaded = reopened.get(KataGoEvaluationKey::fromQuery(1, B, query));
+
+    bool is_valid_test_0 = is_appended_found
+        && is_missed_before_load
+        && loaded.has_value()
+        && reopened.getEntryCount() == 2
+        && loaded->score == -3.5
+        && loaded->ownership[2][3] == -1
+        && std::abs(loaded->ownership[0][0] - 0.5) < 0.01
+        && loaded->candidates.size() == 2
+        && loaded->candidates[1].move == "pass"
+        && !reopened.get(KataGoEvaluationKey::fromQuery(1, W, query)).has_value();
+    printTestResult("testDiskCache[0]", is_valid_test_0);
+
+    // Going over the cap keeps the newest records only
+    KataGoDiskCache capped(path, 4096);
+    for (int i = 0; i < 100; i++) {
+        capped.put(KataGoEvaluationKey::fromQuery(100 + i, B, query), evaluation);
+    }
+
+    bool is_valid_test_1 = capped.getFileSize() <= 4096
+        && capped.get(KataGoEvaluationKey::fromQuery(199, B, query)).has_value()
+        && !capped.get(KataGoEvaluationKey::fromQuery(100, B, query)).has_value();
+    printTestResult("testDiskCache[1]", is_valid_test_1);
+
+    // The record that pushed the file over the cap survives the compaction
+    int last_key = 0;
+    bool is_compacted = false;
+    for (int i = 0; i < 100 && !is_compacted; i++) {
+        size_t before = capped.getFileSize();
+        last_key = 200 + i;
+        capped.put(KataGoEvaluationKey::fromQuery(last_key, B, query), evaluation);
+        is_compacted = capped.getFileSize() < before;
+    }
+
+    bool is_valid_test_2 = is_compacted
+        && capped.get(KataGoEvaluationKey::fromQuery(last_key, B, query)).has_value();
+    printTestResult("testDiskCache[2]", is_valid_test_2);
+
+    std::remove(path.c_str());
+
+    std::cout << std::endl;
+    return is_valid_test_0
+        && is_valid_test_1
+        && is_valid_test_2;
+}
+
 #undef W
 #undef B
 
@@ -165,8 +1062,33 @@ inline bool testValidKatago () {
 inline bool isTestPassed () {
     bool is_test_passing = testCaptureGroups()
         && testValidPlacement()
-        && testValidKatago();
+        && testGroupTable()
+        && testKo()
+        && testGameTree()
+        && testPositionStats()
+        && testLegalMoves()
+        && testBoardKernels()
+        && testValidKatago()
+        && testKataGoMoveList()
+        && testResponseDecoder()
+        && testKataGoDispatcher()
+        && testLineFramer()
+        && testEvaluationCache();
 
     printTestResult("Test", is_test_passing);
     return is_test_passing;
 };
+
+// Tests that write files, start processes or wait on timeouts, too slow to
+// hold up every launch and changing global state. Run with --test.
+inline bool isSystemTestPassed () {
+    bool is_test_passing = testKataGoSettings()
+        && testDiskCache()
+#ifndef WINDOWS
+        && testEnginePool()
+#endif
+        ;
+
+    printTestResult("System test", is_test_passing);
+    return is_test_passing;
+}
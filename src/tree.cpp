@@ -0,0 +1,43 @@
+#include "tree.hpp"
+
+GoGameTree::GoGameTree (const GoPositionHash& root_hash) {
+    this->root = std::make_shared<const GoGameNode>(
+        GoGameNode{nullptr, 0, 0, 0, 0, root_hash, {}}
+    );
+}
+
+GoGameLine GoGameTree::addChild (
+    const GoGameLine& parent,
+    GoPackedMove move,
+    const GoPositionHash& hash,
+    const std::vector<uint16_t>& captured
+) {
+    std::vector<GoGameLine>& siblings = children[parent.get()];
+    for (const GoGameLine& child : siblings) {
+        if (child->move == move) return child;
+    }
+
+    uint32_t offset = this->captured.size();
+    this->captured.insert(this->captured.end(), captured.begin(), captured.end());
+
+    GoPositionStats stats = parent->stats.after(move, captured.size());
+    siblings.push_back(std::make_shared<const GoGameNode>(GoGameNode{
+        parent, move, static_cast<uint16_t>(captured.size()), parent->move_number + 1, offset, hash, stats
+    }));
+    return siblings.back();
+}
+
+const std::vector<GoGameLine>& GoGameTree::getChildren (const GoGameNode* node) const {
+    static const std::vector<GoGameLine> no_children;
+
+    auto it = children.find(node);
+    return it != children.end() ? it->second : no_children;
+}
+
+int GoGameTree::getNodeCount () const {
+    int count = 1;
+    for (const auto& [node, node_children] : children) {
+        count += node_children.size();
+    }
+    return count;
+}
@@ -0,0 +1,104 @@
+#ifndef GO_TREE_H
+#define GO_TREE_H
+
+#include "actions.hpp"
+#include "base.hpp"
+#include "position.hpp"
+#include "zobrist.hpp"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Running totals after a move, derived from the parent's so that reading
+// them for any position is O(1)
+struct GoPositionStats {
+    std::array<int, 2> captures = {0, 0}; // stones taken by each colour
+    std::array<int, 2> stones = {0, 0};   // stones of each colour on the board
+
+    GoPositionStats after (GoPackedMove move, int captured) const {
+        GoPositionStats next = *this;
+        if (isPackedPass(move)) return next;
+
+        int mover = getTurnIndex(getPackedTurn(move));
+        next.stones[mover]++;
+        next.stones[1 - mover] -= captured;
+        next.captures[mover] += captured;
+        return next;
+    }
+};
+
+// One move of a game. Nodes never change once created and hold their parent,
+// so a shared_ptr to any node keeps its whole line alive. Handing a line to
+// another thread only copies the pointer.
+struct GoGameNode {
+    std::shared_ptr<const GoGameNode> parent;
+
+    GoPackedMove move;       // unused on the root
+    uint16_t captured_count; // stones the move captured, see GoGameTree
+    int move_number;         // 0 on the root
+    uint32_t captured_offset;
+    GoPositionHash hash;     // after the move, with the next player to move
+
+    GoPositionStats stats;
+
+    bool isRoot () const { return parent == nullptr; }
+
+    GoTurn getTurnToPlay () const {
+        return isRoot() ? GoTurn::BLACK : getOppositeTurn(getPackedTurn(move));
+    }
+};
+
+typedef std::shared_ptr<const GoGameNode> GoGameLine;
+
+// Every variation played from an empty board. Lines share their common
+// prefix, so memory grows with the number of distinct moves only.
+class GoGameTree {
+    GoGameLine root;
+
+    // Children of each node in the order they were first played. Kept out of
+    // the nodes so that they stay immutable and ownership only points up.
+    std::unordered_map<const GoGameNode*, std::vector<GoGameLine>> children;
+
+    // Point indexes of the stones captured by every move of the tree. A node
+    // owns [captured_offset, captured_offset + captured_count). Only read by
+    // the thread adding to the tree, other threads get lines, not boards.
+    std::vector<uint16_t> captured;
+
+public:
+    GoGameTree (const GoPositionHash& root_hash);
+
+    const GoGameLine& getRoot () const { return root; }
+
+    // The child of parent playing move, created the first time it is played
+    GoGameLine addChild (
+        const GoGameLine& parent,
+        GoPackedMove move,
+        const GoPositionHash& hash,
+        const std::vector<uint16_t>& captured
+    );
+
+    const std::vector<GoGameLine>& getChildren (const GoGameNode* node) const;
+    int getNodeCount () const;
+    size_t getCapturedSize () const { return captured.size(); }
+
+    // Calls fn(index) for every point captured by the move of node
+    template <typename Fn>
+    void forEachCaptured (const GoGameNode& node, Fn fn) const {
+        for (uint32_t i = 0; i < node.captured_count; i++) {
+            fn(static_cast<int>(captured[node.captured_offset + i]));
+        }
+    }
+};
+
+// Moves from the root to node, oldest first
+inline std::vector<GoPackedMove> getLineMoves (const GoGameNode* node) {
+    std::vector<GoPackedMove> moves(node->move_number);
+    for (; !node->isRoot(); node = node->parent.get()) {
+        moves[node->move_number - 1] = node->move;
+    }
+    return moves;
+}
+
+#endif
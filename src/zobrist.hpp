@@ -0,0 +1,46 @@
+#ifndef GO_ZOBRIST_H
+#define GO_ZOBRIST_H
+
+#include "base.hpp"
+#include <array>
+#include <cstdint>
+
+#define GO_ZOBRIST_POINTS (19 * 19)
+
+constexpr uint64_t splitMix64 (uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// [colour][x * size + y] for stones, followed by the two side to move keys
+constexpr std::array<uint64_t, GO_ZOBRIST_POINTS * 2 + 2> genZobristKeys () {
+    std::array<uint64_t, GO_ZOBRIST_POINTS * 2 + 2> keys = {};
+    uint64_t state = 0x5EED5EED5EED5EEDULL;
+    for (size_t i = 0; i < keys.size(); i++) {
+        keys[i] = splitMix64(state);
+    }
+    return keys;
+}
+
+constexpr std::array<uint64_t, GO_ZOBRIST_POINTS * 2 + 2> ZOBRIST_KEYS = genZobristKeys();
+
+inline uint64_t getZobristStoneKey (GoTurn turn, int index) {
+    return ZOBRIST_KEYS[(turn == GoTurn::BLACK ? 0 : GO_ZOBRIST_POINTS) + index];
+}
+
+inline uint64_t getZobristTurnKey (GoTurn to_move) {
+    return ZOBRIST_KEYS[GO_ZOBRIST_POINTS * 2 + (to_move == GoTurn::BLACK ? 0 : 1)];
+}
+
+struct GoPositionHash {
+    uint64_t position;
+    uint64_t situation; // position plus the player to move
+};
+
+inline GoPositionHash getPositionHash (uint64_t position, GoTurn to_move) {
+    return {position, position ^ getZobristTurnKey(to_move)};
+}
+
+#endif